@@ -39,11 +39,23 @@
 enum {
 	OPTION_XV_ACCEL,
 	OPTION_USE_GPU,
+	OPTION_COMMIT_OPS,
+	OPTION_COMMIT_PIXELS,
+	OPTION_FILL_THRESHOLD,
+	OPTION_COPY_THRESHOLD,
+	OPTION_PUTIMAGE_THRESHOLD,
+	OPTION_READBACK_THRESHOLD,
 };
 
 const OptionInfoRec armada_drm_options[] = {
 	{ OPTION_XV_ACCEL,	"XvAccel",	OPTV_BOOLEAN, {0}, FALSE },
 	{ OPTION_USE_GPU,	"UseGPU",	OPTV_BOOLEAN, {0}, FALSE },
+	{ OPTION_COMMIT_OPS,	"CommitOps",	OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_COMMIT_PIXELS,	"CommitPixels",	OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_FILL_THRESHOLD, "FillThreshold", OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_COPY_THRESHOLD, "CopyThreshold", OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_PUTIMAGE_THRESHOLD, "PutImageThreshold", OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_READBACK_THRESHOLD, "ReadbackThreshold", OPTV_INTEGER, {0}, FALSE },
 	{ -1,			NULL,		OPTV_NONE,    {0}, FALSE }
 };
 
@@ -392,6 +404,8 @@ static Bool armada_drm_ScreenInit(SCREEN_INIT_ARGS_DECL)
 
 	if (arm->accel) {
 		struct drm_armada_bufmgr *mgr = arm->bufmgr;
+		struct vivante_options options;
+		int val;
 
 		/*
 		 * Only pass the armada-drm bo manager if we are really
@@ -400,7 +414,32 @@ static Bool armada_drm_ScreenInit(SCREEN_INIT_ARGS_DECL)
 		if (!arm->version || !strstr(arm->version->name, "armada"))
 			mgr = NULL;
 
-		if (!vivante_ScreenInit(pScreen, mgr)) {
+		options.commit_ops = 2048;
+		if (xf86GetOptValInteger(arm->Options, OPTION_COMMIT_OPS, &val))
+			options.commit_ops = val < 0 ? 0 : val;
+
+		options.commit_pixels = 8 * 1024 * 1024;
+		if (xf86GetOptValInteger(arm->Options, OPTION_COMMIT_PIXELS, &val))
+			options.commit_pixels = val < 0 ? 0 : val;
+
+		/* Thresholds which are not set are calibrated */
+		options.fill_threshold = -1;
+		if (xf86GetOptValInteger(arm->Options, OPTION_FILL_THRESHOLD, &val))
+			options.fill_threshold = val < 0 ? 0 : val;
+
+		options.copy_threshold = -1;
+		if (xf86GetOptValInteger(arm->Options, OPTION_COPY_THRESHOLD, &val))
+			options.copy_threshold = val < 0 ? 0 : val;
+
+		options.putimage_threshold = -1;
+		if (xf86GetOptValInteger(arm->Options, OPTION_PUTIMAGE_THRESHOLD, &val))
+			options.putimage_threshold = val < 0 ? 0 : val;
+
+		options.readback_threshold = -1;
+		if (xf86GetOptValInteger(arm->Options, OPTION_READBACK_THRESHOLD, &val))
+			options.readback_threshold = val < 0 ? 0 : val;
+
+		if (!vivante_ScreenInit(pScreen, mgr, &options)) {
 			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 				   "[drm] Vivante initialization failed, running unaccelerated\n");
 			arm->accel = FALSE;
@@ -39,6 +39,133 @@
 vivante_Key vivante_pixmap_index;
 vivante_Key vivante_screen_index;
 
+static void vivante_free_vpix(struct vivante *vivante,
+	struct vivante_pixmap *vPix)
+{
+	if (vPix->bo->type == DRM_ARMADA_BO_SHMEM && vPix->info)
+		vivante_unmap_gpu(vivante, vPix);
+	if (vPix->bo->type != DRM_ARMADA_BO_SHMEM)
+		vivante_unmap_from_gpu(vivante, vPix->info, vPix->handle);
+	drm_armada_bo_put(vPix->bo);
+	vivante_freelist_free(&vivante->pixmap_freelist, vPix);
+}
+
+/*
+ * Pixmap bo cache.  Rather than releasing the bos of pixmaps we
+ * created, keep them along with their GPU mappings for reuse by new
+ * pixmaps of the same bpp and similar pitch and size.  The cached
+ * vivante_pixmaps themselves are kept, as they carry the mapping and
+ * cache ownership state.  Cached bos are kept in power-of-two size
+ * buckets, and on an LRU list which is trimmed to the memory budget,
+ * and of bos which have been idle for a while from the block handler.
+ */
+static unsigned vivante_bo_cache_bucket(size_t size)
+{
+	unsigned b = 0;
+
+	for (size = (size - 1) >> 12; size; size >>= 1)
+		b++;
+
+	return min(b, VIVANTE_BO_CACHE_BUCKETS - 1);
+}
+
+static void vivante_bo_cache_remove(struct vivante_bo_cache *cache,
+	struct vivante_pixmap *vPix)
+{
+	xorg_list_del(&vPix->cache_node);
+	xorg_list_del(&vPix->cache_lru);
+	cache->size -= vPix->bo->size;
+}
+
+/*
+ * Bos are filed by their allocated size, which includes the pitch
+ * alignment and page rounding of the allocator.  We only know the
+ * unaligned pitch here, so search every bucket which a bo with an
+ * acceptable pitch could have been filed in.  Page rounding does not
+ * move a size to another bucket.
+ */
+static struct vivante_pixmap *vivante_bo_cache_get(struct vivante *vivante,
+	int w, int h, int bpp)
+{
+	struct vivante_bo_cache *cache = &vivante->bo_cache;
+	struct vivante_pixmap *vPix;
+	unsigned pitch = w * bpp / 8;
+	unsigned b, last;
+
+	b = vivante_bo_cache_bucket((size_t)pitch * h);
+	last = vivante_bo_cache_bucket((size_t)(pitch +
+				VIVANTE_BO_CACHE_PITCH_SLACK - 1) * h);
+
+	for (; b <= last; b++) {
+		xorg_list_for_each_entry(vPix, &cache->bucket[b], cache_node) {
+			if (vPix->bpp == bpp && vPix->pitch >= pitch &&
+			    vPix->pitch < pitch + VIVANTE_BO_CACHE_PITCH_SLACK &&
+			    vPix->bo->size >= vPix->pitch * h) {
+				vivante_bo_cache_remove(cache, vPix);
+				cache->hits++;
+				return vPix;
+			}
+		}
+	}
+
+	cache->misses++;
+
+	return NULL;
+}
+
+static void vivante_bo_cache_trim(struct vivante *vivante, size_t size,
+	CARD32 expire)
+{
+	struct vivante_bo_cache *cache = &vivante->bo_cache;
+	struct vivante_pixmap *vPix, *n;
+
+	xorg_list_for_each_entry_safe(vPix, n, &cache->lru, cache_lru) {
+		if (cache->size <= size &&
+		    (int32_t)(vPix->cache_time - expire) >= 0)
+			break;
+
+		vivante_bo_cache_remove(cache, vPix);
+		vivante_free_vpix(vivante, vPix);
+		cache->trimmed++;
+	}
+}
+
+static Bool vivante_bo_cache_put(struct vivante *vivante,
+	struct vivante_pixmap *vPix)
+{
+	struct vivante_bo_cache *cache = &vivante->bo_cache;
+	CARD32 now = GetTimeInMillis();
+
+	if (vPix->bo->size > VIVANTE_BO_CACHE_BYTES / 4)
+		return FALSE;
+
+	vPix->cache_time = now;
+	xorg_list_add(&vPix->cache_node,
+		      &cache->bucket[vivante_bo_cache_bucket(vPix->bo->size)]);
+	xorg_list_append(&vPix->cache_lru, &cache->lru);
+	cache->size += vPix->bo->size;
+
+	vivante_bo_cache_trim(vivante, VIVANTE_BO_CACHE_BYTES,
+			      now - VIVANTE_BO_CACHE_EXPIRE);
+
+	return TRUE;
+}
+
+static void vivante_bo_cache_init(struct vivante *vivante)
+{
+	struct vivante_bo_cache *cache = &vivante->bo_cache;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_BO_CACHE_BUCKETS; i++)
+		xorg_list_init(&cache->bucket[i]);
+	xorg_list_init(&cache->lru);
+}
+
+static void vivante_bo_cache_fini(struct vivante *vivante)
+{
+	vivante_bo_cache_trim(vivante, 0, GetTimeInMillis());
+}
+
 void vivante_free_pixmap(PixmapPtr pixmap)
 {
 	struct vivante_pixmap *vPix = vivante_get_pixmap_priv(pixmap);
@@ -47,14 +174,32 @@ void vivante_free_pixmap(PixmapPtr pixmap)
 		struct vivante *vivante;
 
 		vivante = vivante_get_screen_priv(pixmap->drawable.pScreen);
-		vivante_batch_wait_commit(vivante, vPix);
-		if (vPix->bo->type == DRM_ARMADA_BO_SHMEM && vPix->owner == GPU)
-			vivante_unmap_gpu(vivante, vPix);
-		if (vPix->bo->type != DRM_ARMADA_BO_SHMEM)
-			vivante_unmap_from_gpu(vivante, vPix->info,
-					       vPix->handle);
-		drm_armada_bo_put(vPix->bo);
-		free(vPix);
+		vivante_batch_wait_commit(vivante, vPix, ACCESS_RW);
+		if (vPix->tile_cached)
+			vivante_tile_cache_invalidate(vivante, vPix);
+		if (vPix->bo_reuse && vivante_bo_cache_put(vivante, vPix))
+			return;
+		vivante_free_vpix(vivante, vPix);
+	}
+}
+
+/*
+ * This is an imprecise conversion to the Vivante GAL format.
+ * Although pixmaps in X generally don't have an alpha channel,
+ * we must set the format to include the alpha channel to
+ * ensure that the GPU copies all the bits.
+ */
+static gceSURF_FORMAT vivante_pixmap_format(PixmapPtr pixmap)
+{
+	switch (pixmap->drawable.bitsPerPixel) {
+	case 16:
+		if (pixmap->drawable.depth == 15)
+			return gcvSURF_A1R5G5B5;
+		return gcvSURF_R5G6B5;
+	case 32:
+		return gcvSURF_A8R8G8B8;
+	default:
+		return gcvSURF_UNKNOWN;
 	}
 }
 
@@ -84,31 +229,18 @@ void vivante_set_pixmap_bo(PixmapPtr pixmap, struct drm_armada_bo *bo)
 			goto fail;
 		}
 
-		/*
-		 * This is an imprecise conversion to the Vivante GAL format.
-		 * Although pixmaps in X generally don't have an alpha channel,
-		 * we must set the format to include the alpha channel to
-		 * ensure that the GPU copies all the bits.
-		 */
-		switch (pixmap->drawable.bitsPerPixel) {
-		case 16:
-			if (pixmap->drawable.depth == 15)
-				format = gcvSURF_A1R5G5B5;
-			else
-				format = gcvSURF_R5G6B5;
-			break;
-		case 32:
-			format = gcvSURF_A8R8G8B8;
-			break;
-		default:
+		format = vivante_pixmap_format(pixmap);
+		if (format == gcvSURF_UNKNOWN)
 			goto fail;
-		}
 
-		vPix = calloc(1, sizeof *vPix);
+		vPix = vivante_freelist_alloc(&vivante->pixmap_freelist);
 		if (!vPix)
 			goto fail;
 
+		memset(vPix, 0, sizeof *vPix);
+
 		vPix->bo = bo;
+		vPix->bpp = pixmap->drawable.bitsPerPixel;
 		vPix->width = pixmap->drawable.width;
 		vPix->height = pixmap->drawable.height;
 		vPix->pitch = bo->pitch;
@@ -124,7 +256,8 @@ void vivante_set_pixmap_bo(PixmapPtr pixmap, struct drm_armada_bo *bo)
 		if (bo->type != DRM_ARMADA_BO_SHMEM) {
 			if (!vivante_map_bo_to_gpu(vivante, bo, &vPix->info,
 						   &vPix->handle)) {
-				free(vPix);
+				vivante_freelist_free(&vivante->pixmap_freelist,
+						      vPix);
 				vPix = NULL;
 				goto fail;
 			}
@@ -174,11 +307,24 @@ static Bool vivante_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 		 */
 		return FALSE;
 
+	case FillStippled:
+	case FillOpaqueStippled:
+		/* Expanded by the 2D engine from the CPU copy of the stipple */
+		return pGC->stipple &&
+			!vivante_get_pixmap_priv(pGC->stipple);
+
 	default:
 		return FALSE;
 	}
 }
 
+/* Zero width solid lines are drawn as fills of their pixel runs */
+static Bool vivante_GCline_can_accel(GCPtr pGC, DrawablePtr pDrawable)
+{
+	return pGC->lineWidth == 0 && pGC->lineStyle == LineSolid &&
+		vivante_GCfill_can_accel(pGC, pDrawable);
+}
+
 
 static void
 vivante_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n, DDXPointPtr ppt,
@@ -225,6 +371,24 @@ vivante_CopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 			vivante_accel_CopyNtoN, 0, NULL);
 }
 
+static RegionPtr
+vivante_CopyPlane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	int srcx, int srcy, int w, int h, int dstx, int dsty,
+	unsigned long bitPlane)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDst->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDst));
+
+	if (vivante->force_fallback || pSrc->bitsPerPixel != 1 ||
+	    !(bitPlane & 1))
+		return vivante_unaccel_CopyPlane(pSrc, pDst, pGC, srcx, srcy,
+						 w, h, dstx, dsty, bitPlane);
+
+	return miDoCopy(pSrc, pDst, pGC, srcx, srcy, w, h, dstx, dsty,
+			vivante_accel_Copy1toN, bitPlane, NULL);
+}
+
 static void
 vivante_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 	DDXPointPtr ppt)
@@ -239,6 +403,170 @@ vivante_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 		vivante_unaccel_PolyPoint(pDrawable, pGC, mode, npt, ppt);
 }
 
+#ifdef DEBUG_CHECK_POLYLINES
+/*
+ * Draw the lines on the GPU and with fb, starting from the same
+ * destination contents, and report the pixels which differ.  The fb
+ * result is left in the drawable.
+ */
+static void vivante_check_PolyLines(DrawablePtr pDrawable, GCPtr pGC,
+	int mode, int npt, DDXPointPtr ppt)
+{
+	unsigned stride, size, bytes;
+	int i, x, y, w, h, diff;
+	char *orig, *gpu, *cpu;
+	BoxRec ext;
+	GCPtr pCopy;
+
+	if (npt < 1)
+		return;
+
+	ext.x1 = ext.x2 = x = ppt[0].x;
+	ext.y1 = ext.y2 = y = ppt[0].y;
+	for (i = 1; i < npt; i++) {
+		if (mode == CoordModePrevious) {
+			x += ppt[i].x;
+			y += ppt[i].y;
+		} else {
+			x = ppt[i].x;
+			y = ppt[i].y;
+		}
+		ext.x1 = min(ext.x1, x);
+		ext.y1 = min(ext.y1, y);
+		ext.x2 = max(ext.x2, x);
+		ext.y2 = max(ext.y2, y);
+	}
+	ext.x1 = max(ext.x1, 0);
+	ext.y1 = max(ext.y1, 0);
+	ext.x2 = min(ext.x2 + 1, (int)pDrawable->width);
+	ext.y2 = min(ext.y2 + 1, (int)pDrawable->height);
+	w = ext.x2 - ext.x1;
+	h = ext.y2 - ext.y1;
+
+	stride = PixmapBytePad(w, pDrawable->depth);
+	size = stride * h;
+	orig = w > 0 && h > 0 ? malloc(3 * size) : NULL;
+	if (!orig) {
+		if (!vivante_accel_PolyLines(pDrawable, pGC, mode, npt, ppt))
+			vivante_unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+		return;
+	}
+	gpu = orig + size;
+	cpu = gpu + size;
+
+	vivante_unaccel_GetImage(pDrawable, ext.x1, ext.y1, w, h, ZPixmap,
+				 ~0UL, orig);
+	if (!vivante_accel_PolyLines(pDrawable, pGC, mode, npt, ppt)) {
+		vivante_unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+		free(orig);
+		return;
+	}
+	vivante_unaccel_GetImage(pDrawable, ext.x1, ext.y1, w, h, ZPixmap,
+				 ~0UL, gpu);
+
+	pCopy = GetScratchGC(pDrawable->depth, pDrawable->pScreen);
+	if (pCopy) {
+		ValidateGC(pDrawable, pCopy);
+		vivante_unaccel_PutImage(pDrawable, pCopy, pDrawable->depth,
+					 ext.x1, ext.y1, w, h, 0, ZPixmap,
+					 orig);
+		FreeScratchGC(pCopy);
+	}
+	vivante_unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+	vivante_unaccel_GetImage(pDrawable, ext.x1, ext.y1, w, h, ZPixmap,
+				 ~0UL, cpu);
+
+	bytes = w * pDrawable->bitsPerPixel / 8;
+	for (y = 0, diff = 0; y < h; y++)
+		if (memcmp(gpu + y * stride, cpu + y * stride, bytes))
+			diff++;
+
+	if (diff)
+		dbg("PolyLines: %d of %d rows differ from fb: npt %d mode %d cap %d fill %d alu %d clip rects %d\n",
+		    diff, h, npt, mode, pGC->capStyle, pGC->fillStyle,
+		    pGC->alu, RegionNumRects(fbGetCompositeClip(pGC)));
+
+	free(orig);
+}
+#endif
+
+static void
+vivante_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
+	DDXPointPtr ppt)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDrawable));
+
+#ifdef DEBUG_CHECK_POLYLINES
+	if (!vivante->force_fallback &&
+	    vivante_GCline_can_accel(pGC, pDrawable)) {
+		vivante_check_PolyLines(pDrawable, pGC, mode, npt, ppt);
+		return;
+	}
+#endif
+
+	if (vivante->force_fallback ||
+	    !vivante_GCline_can_accel(pGC, pDrawable) ||
+	    !vivante_accel_PolyLines(pDrawable, pGC, mode, npt, ppt))
+		vivante_unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+}
+
+static void
+vivante_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDrawable));
+
+	if (vivante->force_fallback ||
+	    !vivante_GCline_can_accel(pGC, pDrawable) ||
+	    !vivante_accel_PolySegment(pDrawable, pGC, nseg, pSeg))
+		vivante_unaccel_PolySegment(pDrawable, pGC, nseg, pSeg);
+}
+
+static void
+vivante_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDrawable));
+
+	if (vivante->force_fallback ||
+	    !vivante_accel_GlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, TRUE))
+		vivante_unaccel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph,
+					      ppci, pglyphBase);
+}
+
+static void
+vivante_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDrawable));
+
+	if (vivante->force_fallback || pGC->fillStyle != FillSolid ||
+	    !vivante_accel_GlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, FALSE))
+		vivante_unaccel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph,
+					     ppci, pglyphBase);
+}
+
+static void
+vivante_PushPixels(GCPtr pGC, PixmapPtr pBitmap, DrawablePtr pDrawable,
+	int w, int h, int x, int y)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	assert(vivante_GC_can_accel(pGC, pDrawable));
+
+	if (vivante->force_fallback || pGC->fillStyle != FillSolid ||
+	    !vivante_accel_PushPixels(pGC, pBitmap, pDrawable, w, h, x, y))
+		vivante_unaccel_PushPixels(pGC, pBitmap, pDrawable, w, h, x, y);
+}
+
 static void
 vivante_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	xRectangle * prect)
@@ -267,10 +595,10 @@ static GCOps vivante_GCOps = {
 	vivante_unaccel_SetSpans,
 	vivante_PutImage,
 	vivante_CopyArea,
-	vivante_unaccel_CopyPlane,
+	vivante_CopyPlane,
 	vivante_PolyPoint,
-	vivante_unaccel_PolyLines,
-	vivante_unaccel_PolySegment,
+	vivante_PolyLines,
+	vivante_PolySegment,
 	miPolyRectangle,
 	miPolyArc,
 	miFillPolygon,
@@ -280,9 +608,9 @@ static GCOps vivante_GCOps = {
 	miPolyText16,
 	miImageText8,
 	miImageText16,
-	vivante_unaccel_ImageGlyphBlt,
-	vivante_unaccel_PolyGlyphBlt,
-	vivante_unaccel_PushPixels
+	vivante_ImageGlyphBlt,
+	vivante_PolyGlyphBlt,
+	vivante_PushPixels
 };
 
 static GCOps vivante_unaccel_GCOps = {
@@ -381,6 +709,15 @@ static Bool vivante_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 #endif
 
+	/* Release the cached pixmaps while our DestroyPixmap is in place */
+	vivante_tile_cache_fini(vivante);
+	vivante_temp_pool_fini(vivante);
+	vivante_glyph_atlas_fini(vivante);
+#ifdef RENDER
+	vivante_glyph_cache_fini(vivante);
+#endif
+	vivante_bo_cache_fini(vivante);
+
 #ifdef RENDER
 	/* Restore the Pointers */
 	ps->Composite = vivante->Composite;
@@ -402,22 +739,18 @@ static Bool vivante_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	pScreen->CreateGC = vivante->CreateGC;
 	pScreen->BitmapToRegion = vivante->BitmapToRegion;
 	pScreen->BlockHandler = vivante->BlockHandler;
+	pScreen->UnrealizeFont = vivante->UnrealizeFont;
 
 #ifdef HAVE_DRI2
 	vivante_dri2_CloseScreen(CLOSE_SCREEN_ARGS);
 #endif
 
-#ifdef VIVANTE_BATCH
-	vivante_unmap_from_gpu(vivante, vivante->batch_info,
-			       vivante->batch_handle);
-#endif
+	vivante_dump_stats(vivante);
 
 	vivante_accel_shutdown(vivante);
 
-#ifdef VIVANTE_BATCH
-	drm_armada_bo_put(vivante->batch_bo);
-#endif
-
+	vivante_freelist_fini(&vivante->pixmap_freelist);
+	vivante_scratch_fini(&vivante->scratch);
 	free(vivante);
 
 	return pScreen->CloseScreen(CLOSE_SCREEN_ARGS);
@@ -448,10 +781,36 @@ vivante_CopyWindow(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc)
 	RegionUninit(&rgnDst);
 }
 
+static void
+vivante_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+	unsigned int format, unsigned long planeMask, char *d)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	if (vivante->force_fallback ||
+	    !vivante_accel_GetImage(pDrawable, x, y, w, h, format, planeMask, d))
+		vivante_unaccel_GetImage(pDrawable, x, y, w, h, format,
+					 planeMask, d);
+}
+
+static void
+vivante_GetSpans(DrawablePtr pDrawable, int wMax, DDXPointPtr ppt,
+	int *pwidth, int nspans, char *pdstStart)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+
+	if (vivante->force_fallback ||
+	    !vivante_accel_GetSpans(pDrawable, wMax, ppt, pwidth, nspans,
+				    pdstStart))
+		vivante_unaccel_GetSpans(pDrawable, wMax, ppt, pwidth, nspans,
+					 pdstStart);
+}
+
 static PixmapPtr
 vivante_CreatePixmap(ScreenPtr pScreen, int w, int h, int depth, unsigned usage)
 {
 	struct vivante *vivante = vivante_get_screen_priv(pScreen);
+	struct vivante_pixmap *vPix;
 	struct drm_armada_bo *bo;
 	PixmapPtr pixmap;
 	int ret, bpp;
@@ -473,6 +832,17 @@ vivante_CreatePixmap(ScreenPtr pScreen, int w, int h, int depth, unsigned usage)
 	if (bpp != 16 && bpp != 32)
 		goto fallback_free_pix;
 
+	vPix = vivante_bo_cache_get(vivante, w, h, bpp);
+	if (vPix) {
+		pScreen->ModifyPixmapHeader(pixmap, w, h, 0, 0, vPix->pitch,
+					    NULL);
+		vPix->width = w;
+		vPix->height = h;
+		vPix->format = vivante_pixmap_format(pixmap);
+		vivante_set_pixmap_priv(pixmap, vPix);
+		goto out;
+	}
+
 	bo = drm_armada_bo_create(vivante->bufmgr, w, h, bpp);
 	if (!bo)
 		goto fallback_free_pix;
@@ -491,9 +861,13 @@ vivante_CreatePixmap(ScreenPtr pScreen, int w, int h, int depth, unsigned usage)
 	pScreen->ModifyPixmapHeader(pixmap, w, h, 0, 0, bo->pitch, NULL);
 
 	vivante_set_pixmap_bo(pixmap, bo);
-	if (!vivante_get_pixmap_priv(pixmap))
+	vPix = vivante_get_pixmap_priv(pixmap);
+	if (!vPix)
 		goto fallback_free_bo;
 
+	/* We own this bo, so it can be cached when the pixmap is freed */
+	vPix->bo_reuse = TRUE;
+
 	drm_armada_bo_put(bo);
 	goto out;
 
@@ -548,12 +922,32 @@ vivante_BlockHandler(BLOCKHANDLER_ARGS_DECL)
 	if (vivante->need_commit)
 		vivante_commit(vivante, FALSE);
 
+	/* No drawing is in progress, so release the scratch arena */
+	vivante_scratch_reset(&vivante->scratch);
+
+	/* Release cached surfaces which have not been reused for a while */
+	vivante_temp_pool_trim(vivante,
+			       GetTimeInMillis() - VIVANTE_TEMP_POOL_EXPIRE);
+	vivante_bo_cache_trim(vivante, VIVANTE_BO_CACHE_BYTES,
+			      GetTimeInMillis() - VIVANTE_BO_CACHE_EXPIRE);
+
 	pScreen->BlockHandler = vivante->BlockHandler;
 	pScreen->BlockHandler(BLOCKHANDLER_ARGS);
 	vivante->BlockHandler = pScreen->BlockHandler;
 	pScreen->BlockHandler = vivante_BlockHandler;
 }
 
+/* Forget any glyphs we hold from a font which is being closed */
+static Bool vivante_UnrealizeFont(ScreenPtr pScreen, FontPtr pFont)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pScreen);
+
+	vivante_glyph_atlas_flush_font(vivante, pFont);
+
+	return vivante->UnrealizeFont ?
+		vivante->UnrealizeFont(pScreen, pFont) : TRUE;
+}
+
 #ifdef RENDER
 static void
 vivante_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
@@ -583,9 +977,35 @@ vivante_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 	vivante_unaccel_Composite(op, pSrc, pMask, pDst, xSrc, ySrc,
 				  xMask, yMask, xDst, yDst, width, height);
 }
+
+static void
+vivante_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int nlist,
+	GlyphListPtr list, GlyphPtr *glyphs)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDst->pDrawable->pScreen);
+
+	if (vivante->force_fallback ||
+	    !vivante_accel_Glyphs(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+				  nlist, list, glyphs))
+		vivante_unaccel_Glyphs(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+				       nlist, list, glyphs);
+}
+
+/* Evict a glyph which is being freed from the glyph cache */
+static void vivante_UnrealizeGlyph(ScreenPtr pScreen, GlyphPtr glyph)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pScreen);
+
+	vivante_glyph_cache_remove(vivante, glyph);
+
+	if (vivante->UnrealizeGlyph)
+		vivante->UnrealizeGlyph(pScreen, glyph);
+}
 #endif
 
-Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
+Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr,
+	const struct vivante_options *options)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 #ifdef RENDER
@@ -608,43 +1028,25 @@ Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	vivante->drm_fd = GET_DRM_INFO(pScrn)->fd;
 	vivante->scrnIndex = pScrn->scrnIndex;
 	vivante->bufmgr = mgr;
-
-#ifdef VIVANTE_BATCH
-	xorg_list_init(&vivante->batch_list);
-	vivante->batch_bo = drm_armada_bo_dumb_create(mgr, 64, 64, 32);
-	if (!vivante->batch_bo) {
-		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
-			   "vivante: unable to create batch bo: %s\n",
-			   strerror(errno));
-		goto fail;
-	}
-
-	if (drm_armada_bo_map(vivante->batch_bo)) {
-		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
-			   "vivante: unable to map batch bo: %s\n",
-			   strerror(errno));
-		goto fail;
+	vivante->bo_cache_maint = TRUE;
+	vivante->commit_max_ops = options->commit_ops;
+	vivante->commit_max_pixels = options->commit_pixels;
+	vivante->cost.threshold[VIVANTE_OP_FILL] = options->fill_threshold;
+	vivante->cost.threshold[VIVANTE_OP_COPY] = options->copy_threshold;
+	vivante->cost.threshold[VIVANTE_OP_PUTIMAGE] = options->putimage_threshold;
+	vivante->cost.threshold[VIVANTE_OP_READBACK] = options->readback_threshold;
+	vivante_freelist_init(&vivante->pixmap_freelist,
+			      sizeof(struct vivante_pixmap));
+	vivante_bo_cache_init(vivante);
+
+	if (!vivante_scratch_init(&vivante->scratch, VIVANTE_SCRATCH_SIZE)) {
+		free(vivante);
+		return FALSE;
 	}
-#endif
 
 	if (!vivante_accel_init(vivante))
 		goto fail;
 
-#ifdef VIVANTE_BATCH
-	if (!vivante_map_bo_to_gpu(vivante, vivante->batch_bo,
-				   &vivante->batch_info,
-				   &vivante->batch_handle))
-		goto fail;
-
-	vivante->batch_ptr = vivante->batch_bo->ptr;
-	vivante->batch_idx_max = vivante->batch_bo->size / sizeof(uint32_t);
-
-//	xf86DrvMsg(vivante->scrnIndex, X_INFO,
-//		   "vivante: created batch at v%p p0x%08x max idx %u\n",
-//		   vivante->batch_ptr, vivante->batch_handle,
-//		   vivante->batch_idx_max);
-#endif
-
 	vivante_set_screen_priv(pScreen, vivante);
 
 #ifdef HAVE_DRI2
@@ -655,9 +1057,9 @@ Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	vivante->CloseScreen = pScreen->CloseScreen;
 	pScreen->CloseScreen = vivante_CloseScreen;
 	vivante->GetImage = pScreen->GetImage;
-	pScreen->GetImage = vivante_unaccel_GetImage;
+	pScreen->GetImage = vivante_GetImage;
 	vivante->GetSpans = pScreen->GetSpans;
-	pScreen->GetSpans = vivante_unaccel_GetSpans;
+	pScreen->GetSpans = vivante_GetSpans;
 	vivante->ChangeWindowAttributes = pScreen->ChangeWindowAttributes;
 	pScreen->ChangeWindowAttributes = vivante_unaccel_ChangeWindowAttributes;
 	vivante->CopyWindow = pScreen->CopyWindow;
@@ -672,13 +1074,16 @@ Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	pScreen->BitmapToRegion = vivante_unaccel_BitmapToRegion;
 	vivante->BlockHandler = pScreen->BlockHandler;
 	pScreen->BlockHandler = vivante_BlockHandler;
+	vivante->UnrealizeFont = pScreen->UnrealizeFont;
+	pScreen->UnrealizeFont = vivante_UnrealizeFont;
 
 #ifdef RENDER
 	vivante->Composite = ps->Composite;
 	ps->Composite = vivante_Composite;
 	vivante->Glyphs = ps->Glyphs;
-	ps->Glyphs = vivante_unaccel_Glyphs;
+	ps->Glyphs = vivante_Glyphs;
 	vivante->UnrealizeGlyph = ps->UnrealizeGlyph;
+	ps->UnrealizeGlyph = vivante_UnrealizeGlyph;
 	vivante->Triangles = ps->Triangles;
 	ps->Triangles = vivante_unaccel_Triangles;
 	vivante->Trapezoids = ps->Trapezoids;
@@ -692,16 +1097,8 @@ Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	return TRUE;
 
 fail:
-#ifdef VIVANTE_BATCH
-	if (vivante->batch_info)
-		vivante_unmap_from_gpu(vivante, vivante->batch_info,
-				       vivante->batch_handle);
-#endif
 	vivante_accel_shutdown(vivante);
-#ifdef VIVANTE_BATCH
-	if (vivante->batch_bo)
-		drm_armada_bo_put(vivante->batch_bo);
-#endif
+	vivante_scratch_fini(&vivante->scratch);
 	free(vivante);
 	return FALSE;
 }
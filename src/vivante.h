@@ -10,8 +10,19 @@
 struct drm_armada_bufmgr;
 struct drm_armada_bo;
 
+/* Tunables passed from the driver options */
+struct vivante_options {
+	unsigned commit_ops;		/* rectangles queued before a commit */
+	unsigned commit_pixels;		/* pixels queued before a commit */
+	int fill_threshold;		/* sizes below which the CPU is used */
+	int copy_threshold;		/* on CPU-owned pixmaps, in pixels, */
+	int putimage_threshold;		/* or -1 to calibrate at start up */
+	int readback_threshold;
+};
+
 /* Acceleration support */
-Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *bufmgr);
+Bool vivante_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *bufmgr,
+	const struct vivante_options *options);
 void vivante_free_pixmap(PixmapPtr pixmap);
 void vivante_set_pixmap_bo(PixmapPtr pixmap, struct drm_armada_bo *bo);
 
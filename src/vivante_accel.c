@@ -13,6 +13,9 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
@@ -20,8 +23,12 @@
 #endif
 #include "fb.h"
 #include "gcstruct.h"
+#include "dixfontstr.h"
+#include "miline.h"
 #include "xf86.h"
 
+#include <armada_bufmgr.h>
+
 #include "vivante_accel.h"
 #include "vivante_unaccel.h"
 #include "vivante_utils.h"
@@ -61,34 +68,314 @@ static CARD32 get_first_pixel(DrawablePtr pDraw)
 	}
 }
 
+/*
+ * 2D engine state handling.  These mirror the gco2D state calls, but
+ * skip the call if the shadow state says the engine already has the
+ * requested value.  State is only marked valid once the call succeeds.
+ */
+static Bool vivante_state_cached(struct vivante *vivante, unsigned state,
+	Bool same)
+{
+	struct vivante_2d_state *st = &vivante->state;
+
+	if (same && st->valid & (1 << state)) {
+		st->skipped[state]++;
+		return TRUE;
+	}
+
+	st->issued[state]++;
+	st->valid &= ~(1 << state);
+
+	return FALSE;
+}
+
+/*
+ * Forget the shadow state for calls which program the engine behind
+ * the back of the helpers below, such as the monochrome brush and
+ * source setup.
+ */
+static void vivante_state_invalidate(struct vivante *vivante, unsigned state)
+{
+	vivante->state.valid &= ~(1 << state);
+}
+
+static gceSTATUS vivante_set_target(struct vivante *vivante,
+	uint32_t handle, unsigned pitch)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	if (vivante_state_cached(vivante, VIVANTE_STATE_TARGET,
+				 st->target_handle == handle &&
+				 st->target_pitch == pitch))
+		return gcvSTATUS_OK;
+
+	err = gco2D_SetTarget(vivante->e2d, handle, pitch, gcvSURF_0_DEGREE, 0);
+	if (err == gcvSTATUS_OK) {
+		st->target_handle = handle;
+		st->target_pitch = pitch;
+		st->valid |= 1 << VIVANTE_STATE_TARGET;
+	}
+	return err;
+}
+
+static gceSTATUS vivante_set_source(struct vivante *vivante,
+	uint32_t handle, unsigned pitch, gceSURF_FORMAT format,
+	unsigned width, unsigned height)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	if (vivante_state_cached(vivante, VIVANTE_STATE_SOURCE,
+				 st->source_handle == handle &&
+				 st->source_pitch == pitch &&
+				 st->source_format == format &&
+				 st->source_width == width &&
+				 st->source_height == height))
+		return gcvSTATUS_OK;
+
+	err = gco2D_SetColorSourceAdvanced(vivante->e2d, handle, pitch, format,
+					   gcvSURF_0_DEGREE, width, height,
+					   gcvFALSE);
+	if (err == gcvSTATUS_OK) {
+		st->source_handle = handle;
+		st->source_pitch = pitch;
+		st->source_format = format;
+		st->source_width = width;
+		st->source_height = height;
+		st->valid |= 1 << VIVANTE_STATE_SOURCE;
+	}
+	return err;
+}
+
+static gceSTATUS vivante_set_clipping(struct vivante *vivante,
+	gcsRECT_PTR clip)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	if (vivante_state_cached(vivante, VIVANTE_STATE_CLIP,
+				 st->clip.left == clip->left &&
+				 st->clip.top == clip->top &&
+				 st->clip.right == clip->right &&
+				 st->clip.bottom == clip->bottom))
+		return gcvSTATUS_OK;
+
+	err = gco2D_SetClipping(vivante->e2d, clip);
+	if (err == gcvSTATUS_OK) {
+		st->clip = *clip;
+		st->valid |= 1 << VIVANTE_STATE_CLIP;
+	}
+	return err;
+}
+
+static gceSTATUS vivante_load_solid_brush(struct vivante *vivante,
+	gceSURF_FORMAT format, uint32_t colour)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	if (vivante_state_cached(vivante, VIVANTE_STATE_BRUSH,
+				 st->brush_format == format &&
+				 st->brush_colour == colour))
+		return gcvSTATUS_OK;
+
+	err = gco2D_LoadSolidBrush(vivante->e2d, format, 0, colour, ~0ULL);
+	if (err == gcvSTATUS_OK) {
+		st->brush_format = format;
+		st->brush_colour = colour;
+		st->valid |= 1 << VIVANTE_STATE_BRUSH;
+	}
+	return err;
+}
+
+static gceSTATUS vivante_load_mono_brush(struct vivante *vivante,
+	uint32_t fg, uint32_t bg, uint64_t bits)
+{
+	vivante_state_invalidate(vivante, VIVANTE_STATE_BRUSH);
+
+	return gco2D_LoadMonochromeBrush(vivante->e2d, 0, 0, 0, fg, bg,
+					 bits, bits);
+}
+
+/*
+ * Source and pattern transparency.  Only the monochrome paths make
+ * pixels transparent; they restore opaque operation when they are
+ * done, which is what every other operation expects.
+ */
+static gceSTATUS vivante_set_transparency(struct vivante *vivante,
+	gce2D_TRANSPARENCY src, gce2D_TRANSPARENCY pat)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	if (vivante_state_cached(vivante, VIVANTE_STATE_TRANSPARENCY,
+				 st->src_transparency == src &&
+				 st->pat_transparency == pat))
+		return gcvSTATUS_OK;
+
+	err = gco2D_SetTransparencyAdvanced(vivante->e2d, src, gcv2D_OPAQUE,
+					    pat);
+	if (err == gcvSTATUS_OK) {
+		st->src_transparency = src;
+		st->pat_transparency = pat;
+		st->valid |= 1 << VIVANTE_STATE_TRANSPARENCY;
+	}
+	return err;
+}
+
+/*
+ * Load the monochrome source.  This also reprograms the transparency:
+ * pixels whose bit is clear are skipped for gcvSURF_SOURCE_MATCH, and
+ * drawn in bg for gcvSURF_OPAQUE.
+ */
+static gceSTATUS vivante_set_mono_source(struct vivante *vivante,
+	Pixel fg, Pixel bg, gceSURF_TRANSPARENCY transparency)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
+
+	vivante_state_invalidate(vivante, VIVANTE_STATE_SOURCE);
+	vivante_state_invalidate(vivante, VIVANTE_STATE_TRANSPARENCY);
+
+	err = gco2D_SetMonochromeSource(vivante->e2d, gcvFALSE, 0,
+					gcvSURF_UNPACKED, gcvFALSE,
+					transparency, fg, bg);
+	if (err == gcvSTATUS_OK) {
+		st->src_transparency = transparency == gcvSURF_SOURCE_MATCH ?
+					gcv2D_KEYED : gcv2D_OPAQUE;
+		st->pat_transparency = gcv2D_OPAQUE;
+		st->valid |= 1 << VIVANTE_STATE_TRANSPARENCY;
+	}
+	return err;
+}
+
 static void vivante_disable_alpha_blend(struct vivante *vivante)
 {
 #ifdef RENDER
-	/* If alpha blending was enabled, disable it now */
-	if (vivante->alpha_blend_enabled) {
-		gceSTATUS err;
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
 
-		vivante->alpha_blend_enabled = FALSE;
+	/* If alpha blending was enabled, disable it now */
+	if (vivante_state_cached(vivante, VIVANTE_STATE_BLEND,
+				 !st->blend_enabled))
+		return;
 
-		err = gco2D_DisableAlphaBlend(vivante->e2d);
-		if (err)
-			vivante_error(vivante, "DisableAlphaBlend", err);
+	err = gco2D_DisableAlphaBlend(vivante->e2d);
+	if (err) {
+		vivante_error(vivante, "DisableAlphaBlend", err);
+		return;
 	}
+
+	st->blend_enabled = FALSE;
+	st->valid |= 1 << VIVANTE_STATE_BLEND;
 #endif
 }
 
+#ifdef RENDER
+static gceSTATUS vivante_enable_alpha_blend(struct vivante *vivante,
+	const struct vivante_blend_op *blend)
+{
+	struct vivante_2d_state *st = &vivante->state;
+	gceSTATUS err;
 
+	if (vivante_state_cached(vivante, VIVANTE_STATE_BLEND,
+				 st->blend_enabled &&
+				 st->blend.src_blend == blend->src_blend &&
+				 st->blend.dst_blend == blend->dst_blend &&
+				 st->blend.src_global_alpha == blend->src_global_alpha &&
+				 st->blend.dst_global_alpha == blend->dst_global_alpha &&
+				 st->blend.src_alpha == blend->src_alpha &&
+				 st->blend.dst_alpha == blend->dst_alpha))
+		return gcvSTATUS_OK;
+
+	err = gco2D_EnableAlphaBlend(vivante->e2d,
+		blend->src_alpha,
+		blend->dst_alpha,
+		gcvSURF_PIXEL_ALPHA_STRAIGHT,
+		gcvSURF_PIXEL_ALPHA_STRAIGHT,
+		blend->src_global_alpha,
+		blend->dst_global_alpha,
+		blend->src_blend,
+		blend->dst_blend,
+		gcvSURF_COLOR_STRAIGHT,
+		gcvSURF_COLOR_STRAIGHT);
+	if (err == gcvSTATUS_OK) {
+		st->blend_enabled = TRUE;
+		st->blend = *blend;
+		st->valid |= 1 << VIVANTE_STATE_BLEND;
+	}
+	return err;
+}
+#endif
 
 #ifdef VIVANTE_BATCH
+/*
+ * The batch serials live in a ring of GPU-visible pages.  Each page
+ * has an occupancy bitmap recording which of its slots belong to a
+ * batch which has not yet been reaped.  When all slots are in flight,
+ * the ring grows by another page, up to VIVANTE_MAX_BATCH_PAGES.
+ */
+#define BATCH_PITCH 64
+#define BATCH_WIDTH (BATCH_PITCH / sizeof(uint32_t))
+#define BATCH_PAGE_SIZE 4096
+#define BATCH_PAGE_SLOTS (BATCH_PAGE_SIZE / sizeof(int32_t))
+
+struct vivante_batch_page {
+	struct drm_armada_bo *bo;
+	int32_t *ptr;
+	void *info;
+	uint32_t handle;
+	uint32_t busy[BATCH_PAGE_SLOTS / 32];
+};
+
 struct vivante_batch {
 	struct xorg_list node;
 	struct xorg_list head;
+	struct xorg_list write_head;
+	struct vivante_batch_page *page;
 	uint32_t index;
 	int32_t serial;
 	int32_t *current;
+	gctSIGNAL signal;
 };
 
-static void vivante_batch_destroy(struct vivante_batch *batch)
+/* Maximum delay between polls of the serial when there is no signal */
+#define BATCH_WAIT_MAX_DELAY	1024
+
+/*
+ * Creating a galcore signal is an ioctl, so idle signals are kept on
+ * a small stack for the next batch rather than destroyed.  A reused
+ * signal is reset before being handed out; should a stale event raise
+ * it early, the waiter falls back to polling the serial.
+ */
+static gctSIGNAL vivante_batch_get_signal(struct vivante *vivante)
+{
+	gctSIGNAL signal;
+
+	if (vivante->batch_nr_signals) {
+		signal = vivante->batch_signal[--vivante->batch_nr_signals];
+		gcoOS_Signal(vivante->os, signal, gcvFALSE);
+		return signal;
+	}
+
+	if (gcoOS_CreateSignal(vivante->os, gcvTRUE, &signal) != gcvSTATUS_OK)
+		signal = NULL;
+
+	return signal;
+}
+
+static void vivante_batch_put_signal(struct vivante *vivante,
+	gctSIGNAL signal)
+{
+	if (vivante->batch_nr_signals < VIVANTE_BATCH_SIGNALS)
+		vivante->batch_signal[vivante->batch_nr_signals++] = signal;
+	else
+		gcoOS_DestroySignal(vivante->os, signal);
+}
+
+static void vivante_batch_destroy(struct vivante *vivante,
+	struct vivante_batch *batch)
 {
 	struct vivante_pixmap *vp, *vn;
 
@@ -97,9 +384,20 @@ static void vivante_batch_destroy(struct vivante_batch *batch)
 		vp->batch = NULL;
 		xorg_list_del(&vp->batch_node);
 	}
+	xorg_list_for_each_entry_safe(vp, vn, &batch->write_head,
+				      batch_write_node) {
+		vp->batch_write = NULL;
+		xorg_list_del(&vp->batch_write_node);
+	}
+
+	if (batch->signal)
+		vivante_batch_put_signal(vivante, batch->signal);
+
+	/* Release the serial slot */
+	batch->page->busy[batch->index / 32] &= ~(1U << (batch->index & 31));
 
 	xorg_list_del(&batch->node);
-	free(batch);
+	vivante_freelist_free(&vivante->batch_freelist, batch);
 }
 
 static void vivante_batch_reap(struct vivante *vivante)
@@ -112,102 +410,277 @@ static void vivante_batch_reap(struct vivante *vivante)
 			dbg("batch %p: reaping at %08x\n",
 			    batch, *batch->current);
 #endif
-			vivante_batch_destroy(batch);
+			vivante_batch_destroy(vivante, batch);
 		}
 	}
 }
 
-static void __vivante_batch_wait(struct vivante_batch *batch)
+/*
+ * Wait for a committed batch to complete.  If the batch has a signal
+ * attached, galcore will raise it once the commit containing the batch
+ * serial has executed, so we can sleep in the kernel.  Otherwise, poll
+ * the serial, backing off exponentially to avoid burning the CPU.
+ *
+ * Batches complete in order, so once this batch is done, so are all
+ * those before it: reap them all.  The time spent waiting is accounted
+ * in the batch wait statistics reported by vivante_dump_stats().
+ */
+static void __vivante_batch_wait(struct vivante *vivante,
+	struct vivante_batch *batch)
 {
 #ifdef DEBUG_BATCH
 	dbg("batch %p: waiting: %08x %08x\n",
 	    batch, *batch->current, batch->serial);
 #endif
-	while (*batch->current != batch->serial)
-		usleep(5);
-	vivante_batch_destroy(batch);
+	if (*batch->current != batch->serial) {
+		struct timespec start, end;
+		useconds_t delay = 1;
+		unsigned long us;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (batch->signal) {
+			gceSTATUS err;
+
+			err = gcoOS_WaitSignal(vivante->os, batch->signal,
+					       gcvINFINITE);
+			if (err != gcvSTATUS_OK)
+				vivante_error(vivante, "gcoOS_WaitSignal", err);
+		}
+
+		while (*batch->current != batch->serial) {
+			usleep(delay);
+			if (delay < BATCH_WAIT_MAX_DELAY)
+				delay <<= 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		us = (end.tv_sec - start.tv_sec) * 1000000 +
+		     (end.tv_nsec - start.tv_nsec) / 1000;
+		if (batch->signal)
+			vivante->batch_wait.signalled++;
+		else
+			vivante->batch_wait.polled++;
+		vivante->batch_wait.total_us += us;
+		if (vivante->batch_wait.max_us < us)
+			vivante->batch_wait.max_us = us;
+#ifdef DEBUG_BATCH
+		dbg("batch %p: %s wait took %luus\n", batch,
+		    batch->signal ? "signal" : "poll", us);
+#endif
+	}
+	vivante_batch_reap(vivante);
 }
 
 /*
- * If the pixmap is part of a batch which is not the current batch,
- * wait for its batch to indicate operations are complete on it.
+ * Issue and wait for outstanding GPU activity for this pixmap to
+ * complete.  A CPU read only needs to wait for the last batch which
+ * wrote the pixmap, whereas a CPU write must also wait for batches
+ * which are still reading it.  If the batch is the current batch,
+ * we need to commit the current batch of operations first.
  */
-static void
-vivante_batch_wait(struct vivante *vivante, struct vivante_pixmap *vPix)
+void vivante_batch_wait_commit(struct vivante *vivante,
+	struct vivante_pixmap *vPix, int access)
+{
+	struct vivante_batch *batch;
+
+	batch = access == ACCESS_RO ? vPix->batch_write : vPix->batch;
+	if (batch) {
+		if (batch == vivante->batch)
+			vivante_commit(vivante, FALSE);
+		__vivante_batch_wait(vivante, batch);
+	}
+}
+
+static Bool vivante_batch_new_page(struct vivante *vivante)
 {
-	struct vivante_batch *batch = vPix->batch;
+	struct vivante_batch_page *page;
+	unsigned n = vivante->batch_nr_pages;
+
+	if (n >= VIVANTE_MAX_BATCH_PAGES)
+		return FALSE;
+
+	page = calloc(1, sizeof *page);
+	if (!page)
+		return FALSE;
+
+	page->bo = drm_armada_bo_dumb_create(vivante->bufmgr, 64,
+				BATCH_PAGE_SIZE / (64 * sizeof(uint32_t)), 32);
+	if (!page->bo) {
+		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
+			   "vivante: unable to create batch bo: %s\n",
+			   strerror(errno));
+		goto free_page;
+	}
+
+	if (drm_armada_bo_map(page->bo)) {
+		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
+			   "vivante: unable to map batch bo: %s\n",
+			   strerror(errno));
+		goto put_bo;
+	}
+
+	if (!vivante_map_bo_to_gpu(vivante, page->bo, &page->info,
+				   &page->handle))
+		goto put_bo;
+
+	page->ptr = page->bo->ptr;
+
+	vivante->batch_page[n] = page;
+	vivante->batch_nr_pages = n + 1;
 
-	if (batch && batch != vivante->batch)
-		__vivante_batch_wait(batch);
+	return TRUE;
+
+ put_bo:
+	drm_armada_bo_put(page->bo);
+ free_page:
+	free(page);
+	return FALSE;
+}
+
+static void vivante_batch_free_page(struct vivante *vivante,
+	struct vivante_batch_page *page)
+{
+	vivante_unmap_from_gpu(vivante, page->info, page->handle);
+	drm_armada_bo_put(page->bo);
+	free(page);
 }
 
 /*
- * Issue and wait for all outstanding GPU activity for this pixmap to
- * complete.  Essentially, that means if this pixmap is attached to a
- * batch, it is busy, and if the batch is the current batch, we need
- * to commit the current batch of operations.
+ * Find a free serial slot, searching from the ring cursor.  Returns
+ * the ring-wide slot number, or -1 if every slot is in flight.
  */
-void
-vivante_batch_wait_commit(struct vivante *vivante, struct vivante_pixmap *vPix)
+static int vivante_batch_find_slot(struct vivante *vivante)
 {
-	struct vivante_batch *batch = vPix->batch;
+	unsigned i, nr = vivante->batch_nr_pages * BATCH_PAGE_SLOTS;
+	unsigned slot = vivante->batch_slot;
 
-	if (batch) {
-		if (batch == vivante->batch)
-			vivante_commit(vivante, TRUE);
-		__vivante_batch_wait(batch);
+	for (i = 0; i < nr; i++, slot++) {
+		struct vivante_batch_page *page;
+		unsigned idx;
+		uint32_t busy;
+
+		if (slot >= nr)
+			slot = 0;
+
+		page = vivante->batch_page[slot / BATCH_PAGE_SLOTS];
+		idx = slot % BATCH_PAGE_SLOTS;
+		busy = page->busy[idx / 32] >> (idx & 31);
+
+		if (!(busy & 1))
+			return slot;
+
+		/* Skip the remainder of a fully occupied word */
+		if (busy == ~0U >> (idx & 31)) {
+			i += 31 - (idx & 31);
+			slot += 31 - (idx & 31);
+		}
 	}
+
+	return -1;
 }
 
 static Bool vivante_batch_new(struct vivante *vivante)
 {
+	struct vivante_batch_page *page;
 	struct vivante_batch *batch;
 	int32_t serial;
+	int slot;
+
+	vivante->batch = NULL;
 
 	vivante_batch_reap(vivante);
 
+	slot = vivante_batch_find_slot(vivante);
+	if (slot < 0) {
+		/*
+		 * Every serial slot belongs to an outstanding batch.  Grow
+		 * the ring rather than stall; only if we can't grow, wait
+		 * for the oldest batch to free its slot.
+		 */
+		if (vivante_batch_new_page(vivante)) {
+			slot = (vivante->batch_nr_pages - 1) * BATCH_PAGE_SLOTS;
+			xf86DrvMsg(vivante->scrnIndex, X_INFO,
+				   "vivante: batch ring grown to %u slots\n",
+				   vivante->batch_nr_pages * BATCH_PAGE_SLOTS);
+		} else if (!xorg_list_is_empty(&vivante->batch_list)) {
+			__vivante_batch_wait(vivante,
+				xorg_list_first_entry(&vivante->batch_list,
+						struct vivante_batch, node));
+			slot = vivante_batch_find_slot(vivante);
+		}
+		if (slot < 0)
+			return FALSE;
+	}
+
+	batch = vivante_freelist_alloc(&vivante->batch_freelist);
+	if (!batch)
+		return FALSE;
+
 	serial = vivante->batch_serial + 1;
 	if (serial <= 0)
 		serial = 1;
 	vivante->batch_serial = serial;
 
-	batch = malloc(sizeof *batch);
-	if (batch) {
-		uint16_t i = vivante->batch_idx;
-
-		batch->index = i;
-		batch->serial = serial;
-		batch->current = vivante->batch_ptr + i;
-		*batch->current = -1;
-		xorg_list_init(&batch->head);
+	page = vivante->batch_page[slot / BATCH_PAGE_SLOTS];
 
-		i += 1;
-		if (i >= vivante->batch_idx_max)
-			i = 0;
+	batch->page = page;
+	batch->index = slot % BATCH_PAGE_SLOTS;
+	batch->serial = serial;
+	batch->current = page->ptr + batch->index;
+	*batch->current = -1;
+	page->busy[batch->index / 32] |= 1U << (batch->index & 31);
+	xorg_list_init(&batch->node);
+	xorg_list_init(&batch->head);
+	xorg_list_init(&batch->write_head);
 
-		vivante->batch_idx = i;
-	}
+	/*
+	 * If we can't get a signal, we fall back to polling
+	 * the batch serial in __vivante_batch_wait().
+	 */
+	batch->signal = vivante_batch_get_signal(vivante);
 
+	vivante->batch_slot = slot + 1;
 	vivante->batch = batch;
 
-	return batch ? TRUE : FALSE;
+	return TRUE;
 }
 
-/* Add the pixmap to the current batch, if not already added */
-static void
-vivante_batch_add(struct vivante *vivante, struct vivante_pixmap *vPix)
+/*
+ * Add the pixmap to the current batch, if not already added.  vPix->batch
+ * tracks the last batch to access the pixmap, vPix->batch_write the last
+ * batch to write it.  As batches complete in order, a pixmap simply moves
+ * from an older batch to the current one.
+ */
+static void vivante_batch_add(struct vivante *vivante,
+	struct vivante_pixmap *vPix, int access)
 {
-	struct vivante_batch *batch = vPix->batch;
+	struct vivante_batch *batch = vivante->batch;
 
-	if (!batch) {
-		vPix->batch = batch = vivante->batch;
+	if (vPix->batch != batch) {
+		if (vPix->batch)
+			xorg_list_del(&vPix->batch_node);
+		vPix->batch = batch;
 		xorg_list_add(&vPix->batch_node, &batch->head);
 #ifdef DEBUG_BATCH
 		dbg("Allocated batch %p for vPix %p\n", batch, vPix);
 #endif
-		vivante->need_commit = TRUE;
 	}
-	assert(vPix->batch == vivante->batch);
+
+	if (access == ACCESS_RW && vPix->tile_cached)
+		vivante_tile_cache_invalidate(vivante, vPix);
+
+	if (access == ACCESS_RW)
+		vPix->gpu_dirty = TRUE;
+
+	if (access == ACCESS_RW && vPix->batch_write != batch) {
+		if (vPix->batch_write)
+			xorg_list_del(&vPix->batch_write_node);
+		vPix->batch_write = batch;
+		xorg_list_add(&vPix->batch_write_node, &batch->write_head);
+	}
+
+	vivante->need_commit = TRUE;
 }
 
 /* Add the batch to the GPU operations right at the very end of the GPU ops */
@@ -215,13 +688,10 @@ static void vivante_batch_commit(struct vivante *vivante)
 {
 	struct vivante_batch *batch = vivante->batch;
 	uint32_t col = batch->serial;
-	uint32_t handle = vivante->batch_handle;
+	uint32_t handle = batch->page->handle;
 	gceSTATUS err;
 	gcsRECT rect;
 
-#define BATCH_PITCH 64
-#define BATCH_WIDTH (BATCH_PITCH / sizeof(uint32_t))
-
 	rect.left = batch->index & (BATCH_WIDTH - 1);
 	rect.top = batch->index / BATCH_WIDTH;
 	rect.right = rect.left + 1;
@@ -235,16 +705,15 @@ static void vivante_batch_commit(struct vivante *vivante)
 
 	vivante_disable_alpha_blend(vivante);
 
-	err = gco2D_LoadSolidBrush(vivante->e2d, gcvSURF_A8R8G8B8, 0, col, ~0ULL);
+	err = vivante_load_solid_brush(vivante, gcvSURF_A8R8G8B8, col);
 	if (err != gcvSTATUS_OK)
 		goto error;
 
-	err = gco2D_SetClipping(vivante->e2d, &rect);
+	err = vivante_set_clipping(vivante, &rect);
 	if (err != gcvSTATUS_OK)
 		goto error;
 
-	err = gco2D_SetTarget(vivante->e2d, handle, BATCH_PITCH,
-			      gcvSURF_0_DEGREE, 0);
+	err = vivante_set_target(vivante, handle, BATCH_PITCH);
 	if (err != gcvSTATUS_OK)
 		goto error;
 
@@ -252,6 +721,28 @@ static void vivante_batch_commit(struct vivante *vivante)
 	if (err != gcvSTATUS_OK)
 		goto error;
 
+	/*
+	 * Ask galcore to raise the batch signal once this commit has
+	 * been executed by the GPU.
+	 */
+	if (batch->signal) {
+		gcsHAL_INTERFACE iface;
+
+		memset(&iface, 0, sizeof(iface));
+		iface.command = gcvHAL_SIGNAL;
+		iface.u.Signal.signal = batch->signal;
+		iface.u.Signal.auxSignal = gcvNULL;
+		iface.u.Signal.process = gcoOS_GetCurrentProcessID();
+		iface.u.Signal.fromWhere = gcvKERNEL_PIXEL;
+
+		err = gcoHAL_ScheduleEvent(vivante->hal, &iface);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gcoHAL_ScheduleEvent", err);
+			vivante_batch_put_signal(vivante, batch->signal);
+			batch->signal = NULL;
+		}
+	}
+
 	xorg_list_append(&batch->node, &vivante->batch_list);
 	vivante->batch = NULL;
 	return;
@@ -260,21 +751,30 @@ static void vivante_batch_commit(struct vivante *vivante)
 	vivante_error(vivante, "batch blit", err);
 }
 #else
-void
-vivante_batch_wait_commit(struct vivante *vivante, struct vivante_pixmap *vPix)
+void vivante_batch_wait_commit(struct vivante *vivante,
+	struct vivante_pixmap *vPix, int access)
 {
-	if (vPix->need_stall && vivante->need_stall) {
+	Bool busy;
+
+	busy = access == ACCESS_RO ? vPix->need_stall_write : vPix->need_stall;
+	if (busy && vivante->need_stall) {
 		vivante_commit(vivante, TRUE);
 		vivante->need_stall = FALSE;
 	}
 }
 
-static void
-vivante_batch_add(struct vivante *vivante, struct vivante_pixmap *vPix)
+static void vivante_batch_add(struct vivante *vivante,
+	struct vivante_pixmap *vPix, int access)
 {
 	vivante->need_stall = TRUE;
 	vivante->need_commit = TRUE;
 	vPix->need_stall = TRUE;
+	if (access == ACCESS_RW) {
+		vPix->need_stall_write = TRUE;
+		vPix->gpu_dirty = TRUE;
+		if (vPix->tile_cached)
+			vivante_tile_cache_invalidate(vivante, vPix);
+	}
 }
 #endif
 
@@ -310,8 +810,6 @@ gal_prepare_gpu(struct vivante *vivante, struct vivante_pixmap *vPix,
 			   "[vivante] %s failed\n", "batch allocation");
 		return FALSE;
 	}
-
-	vivante_batch_wait(vivante, vPix);
 #endif
 
 	if (!vivante_map_gpu(vivante, vPix))
@@ -325,8 +823,7 @@ gal_prepare_gpu(struct vivante *vivante, struct vivante_pixmap *vPix,
 
 	switch (id) {
 	case GPU2D_Target:
-		err = gco2D_SetTarget(vivante->e2d, vPix->handle, vPix->pitch,
-				      gcvSURF_0_DEGREE, 0);
+		err = vivante_set_target(vivante, vPix->handle, vPix->pitch);
 		if (err != gcvSTATUS_OK) {
 			vivante_error(vivante, "gco2D_SetTarget", err);
 			return FALSE;
@@ -334,9 +831,9 @@ gal_prepare_gpu(struct vivante *vivante, struct vivante_pixmap *vPix,
 		break;
 
 	case GPU2D_Source:
-		err = gco2D_SetColorSourceAdvanced(vivante->e2d, vPix->handle,
-				  vPix->pitch, vPix->format, gcvSURF_0_DEGREE,
-				  vPix->width, vPix->height, gcvFALSE);
+		err = vivante_set_source(vivante, vPix->handle, vPix->pitch,
+					 vPix->format, vPix->width,
+					 vPix->height);
 		if (err != gcvSTATUS_OK) {
 			vivante_error(vivante, "gco2D_SetColourSourceAdvanced", err);
 			return FALSE;
@@ -357,8 +854,76 @@ static void vivante_flush(struct vivante *vivante)
 		vivante_error(vivante, "Flush", err);
 }
 
+/*
+ * Decide whether an operation touching 'pixels' pixels is cheaper to
+ * do with the CPU.  Using the GPU on a pixmap the CPU touched last has
+ * a fixed cost: the pixmap may need mapping to the GPU, and the next
+ * CPU access has to wait for the GPU.  Small operations on such
+ * pixmaps are left to the CPU.  Reading back is different: reading a
+ * GPU pixmap with the CPU is slow unless it is cacheable and already
+ * owned by the CPU, so only small reads are done that way.
+ */
+static Bool vivante_cpu_cheaper(struct vivante *vivante,
+	struct vivante_pixmap *vDst, struct vivante_pixmap *vSrc,
+	enum vivante_op op, unsigned long pixels)
+{
+	struct vivante_cost *c = &vivante->cost;
+	Bool cpu;
+
+	if (op == VIVANTE_OP_READBACK)
+		cpu = pixels < c->threshold[op] ||
+		      (vDst->owner == CPU &&
+		       vDst->bo->type == DRM_ARMADA_BO_SHMEM);
+	else
+		cpu = pixels < c->threshold[op] && vDst->owner == CPU &&
+		      (!vSrc || vSrc->owner == CPU);
+
+	if (cpu)
+		c->cpu[op]++;
+	else
+		c->gpu[op]++;
+
+	return cpu;
+}
+
+/*
+ * Account for rectangles queued to the 2D engine.  This is used to
+ * decide when to submit work to the GPU early.
+ */
+static void vivante_queued(struct vivante *vivante, const gcsRECT *r,
+	unsigned n)
+{
+	unsigned long pixels = 0;
+	unsigned i;
+
+	for (i = 0; i < n; i++, r++)
+		pixels += (r->right - r->left) * (r->bottom - r->top);
+
+	vivante->commit_ops += n;
+	vivante->commit_pixels += pixels;
+}
+
+/*
+ * Finish an operation: flush the 2D engine, and if enough work has
+ * been queued, submit it now so the GPU starts on it while we continue
+ * to build up the next lot, rather than waiting for the block handler.
+ */
+static void vivante_submit(struct vivante *vivante)
+{
+	vivante_flush(vivante);
+
+	if ((vivante->commit_max_ops &&
+	     vivante->commit_ops >= vivante->commit_max_ops) ||
+	    (vivante->commit_max_pixels &&
+	     vivante->commit_pixels >= vivante->commit_max_pixels)) {
+		vivante->commit_stats.early++;
+		vivante_commit(vivante, FALSE);
+	}
+}
+
 void vivante_commit(struct vivante *vivante, Bool stall)
 {
+	struct vivante_commit_stats *stats = &vivante->commit_stats;
 	gceSTATUS err;
 
 #ifdef VIVANTE_BATCH
@@ -372,6 +937,21 @@ void vivante_commit(struct vivante *vivante, Bool stall)
 	if (err != gcvSTATUS_OK)
 		vivante_error(vivante, "Commit", err);
 
+	/* Any staging signal events queued so far have now been submitted */
+	vivante->staging.committed = vivante->staging.serial;
+
+	if (vivante->commit_ops) {
+		stats->commits++;
+		stats->ops += vivante->commit_ops;
+		stats->pixels += vivante->commit_pixels;
+		if (stats->max_ops < vivante->commit_ops)
+			stats->max_ops = vivante->commit_ops;
+		if (stats->max_pixels < vivante->commit_pixels)
+			stats->max_pixels = vivante->commit_pixels;
+		vivante->commit_ops = 0;
+		vivante->commit_pixels = 0;
+	}
+
 	vivante->need_commit = FALSE;
 }
 
@@ -431,6 +1011,25 @@ static const gctUINT8 vivante_fill_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
+static const gctUINT8 vivante_copy_rop[] = {
+	/* GXclear        */  0x00,		// ROP_BLACK,
+	/* GXand          */  0x88,		// ROP_DST_AND_SRC,
+	/* GXandReverse   */  0x44,		// ROP_SRC_AND_NOT_DST,
+	/* GXcopy         */  0xcc,		// ROP_SRC,
+	/* GXandInverted  */  0x22,		// ROP_NOT_SRC_AND_DST,
+	/* GXnoop         */  0xaa,		// ROP_DST,
+	/* GXxor          */  0x66,		// ROP_DST_XOR_SRC,
+	/* GXor           */  0xee,		// ROP_DST_OR_SRC,
+	/* GXnor          */  0x11,		// ROP_NOT_SRC_AND_NOT_DST,
+	/* GXequiv        */  0x99,		// ROP_NOT_SRC_XOR_DST,
+	/* GXinvert       */  0x55,		// ROP_NOT_DST,
+	/* GXorReverse    */  0xdd,		// ROP_SRC_OR_NOT_DST,
+	/* GXcopyInverted */  0x33,		// ROP_NOT_SRC,
+	/* GXorInverted   */  0xbb,		// ROP_NOT_SRC_OR_DST,
+	/* GXnand         */  0x77,		// ROP_NOT_SRC_OR_NOT_DST,
+	/* GXset          */  0xff		// ROP_WHITE
+};
+
 static uint32_t vivante_fg_col(GCPtr pGC)
 {
 	if (pGC->fillStyle == FillTiled)
@@ -440,56 +1039,424 @@ static uint32_t vivante_fg_col(GCPtr pGC)
 		return pGC->fgPixel;
 }
 
+static Bool vivante_stipple_bit(const uint8_t *row, int x)
+{
+#if BITMAP_BIT_ORDER == LSBFirst
+	return row[x >> 3] & (1 << (x & 7));
+#else
+	return row[x >> 3] & (0x80 >> (x & 7));
+#endif
+}
+
 /*
- * Generic solid-like blit fill - takes a set of boxes, and fills them
- * according to the clips in the GC.
+ * Convert an 8x8 stipple to a brush mask, rotated so that the brush
+ * origin is the target origin.  ox, oy is the stipple origin on the
+ * target.  See the brush mask layout described above.
  */
-static Bool vivante_fill(struct vivante *vivante, struct vivante_pixmap *vPix,
-	GCPtr pGC, const BoxRec *clipBox, const BoxRec *pBox, unsigned nBox,
-	int dx, int dy)
+static uint64_t vivante_stipple_brush(PixmapPtr pStipple, int ox, int oy)
 {
-	const BoxRec *b;
-	unsigned chunk;
-	gceSTATUS err;
-	gctUINT32 fg;
-	gctUINT8 rop;
+	const uint8_t *base = pStipple->devPrivate.ptr;
+	uint64_t bits = 0;
+	int x, y, sx, sy;
+
+	for (y = 0; y < 8; y++) {
+		const uint8_t *row;
+
+		modulus(y - oy, 8, sy);
+		row = base + sy * pStipple->devKind;
+
+		for (x = 0; x < 8; x++) {
+			modulus(x - ox, 8, sx);
+			if (vivante_stipple_bit(row, sx))
+				bits |= 1ULL << (y * 8 + 7 - x);
+		}
+	}
+	return bits;
+}
+
+/*
+ * Convert an area of a bitmap to a monochrome stream for the 2D engine.
+ * The area starts on a 32-bit boundary, and rows are 32-bit aligned, as
+ * for X bitmaps, with the leftmost pixel in the most significant bit of
+ * each byte.
+ */
+static void *vivante_bitmap_stream(struct vivante *vivante,
+	PixmapPtr pBitmap, const BoxRec *area, unsigned *stride)
+{
+	const uint8_t *src = pBitmap->devPrivate.ptr;
+	unsigned x, y, w, h;
+	uint8_t *stream, *dst;
+
+	w = (area->x2 - area->x1 + 31) / 32 * 4;
+	h = area->y2 - area->y1;
+
+	stream = vivante_scratch_alloc(&vivante->scratch, w * h);
+	if (!stream)
+		return NULL;
+
+	src += area->y1 * pBitmap->devKind + area->x1 / 8;
+
+	for (y = 0, dst = stream; y < h; y++, dst += w, src += pBitmap->devKind) {
+		for (x = 0; x < w; x++) {
+			uint8_t b = src[x];
+#if BITMAP_BIT_ORDER == LSBFirst
+			b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+			b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+			b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+#endif
+			dst[x] = b;
+		}
+	}
+
+	*stride = w;
+
+	return stream;
+}
+
+static void *vivante_stipple_stream(struct vivante *vivante,
+	PixmapPtr pStipple, unsigned *stride)
+{
+	BoxRec area;
+
+	area.x1 = 0;
+	area.y1 = 0;
+	area.x2 = pStipple->drawable.width;
+	area.y2 = pStipple->drawable.height;
+
+	return vivante_bitmap_stream(vivante, pStipple, &area, stride);
+}
+
+/*
+ * Stipples larger than the 8x8 brush are expanded through the 2D
+ * engine's monochrome source.  The stipple is streamed once for each
+ * time it is repeated over the boxes, clipped to each box.
+ */
+static Bool vivante_fill_mono(struct vivante *vivante,
+	struct vivante_pixmap *vPix, DrawablePtr pDrawable, GCPtr pGC,
+	const BoxRec *clipBox, const BoxRec *pBox, unsigned nBox,
+	int dx, int dy)
+{
+	PixmapPtr pStipple = pGC->stipple;
+	gctUINT8 fg_rop, bg_rop;
+	gcsPOINT size;
+	gcsRECT clip;
+	gceSTATUS err;
+	unsigned stride;
+	int sw, sh, ox, oy;
+	void *stream;
+
+	stream = vivante_stipple_stream(vivante, pStipple, &stride);
+	if (!stream)
+		return FALSE;
+
+	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target))
+		return FALSE;
+
+	vivante_disable_alpha_blend(vivante);
+
+	RectBox(&clip, clipBox, dx, dy);
+	err = vivante_set_clipping(vivante, &clip);
+	if (err) {
+		vivante_error(vivante, "gco2D_SetClipping", err);
+		return FALSE;
+	}
+
+	/*
+	 * For FillStippled, clear stipple bits must leave the destination
+	 * alone, so make them transparent rather than relying on bg_rop.
+	 */
+	err = vivante_set_mono_source(vivante, pGC->fgPixel, pGC->bgPixel,
+				      pGC->fillStyle == FillStippled ?
+				      gcvSURF_SOURCE_MATCH : gcvSURF_OPAQUE);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetMonochromeSource", err);
+		return FALSE;
+	}
+
+	fg_rop = vivante_copy_rop[pGC->alu];
+	bg_rop = pGC->fillStyle == FillOpaqueStippled ? fg_rop : 0xaa;
+
+	sw = pStipple->drawable.width;
+	sh = pStipple->drawable.height;
+	size.x = stride * 8;
+	size.y = sh;
+
+	ox = pDrawable->x + pGC->patOrg.x + dx;
+	oy = pDrawable->y + pGC->patOrg.y + dy;
+
+	for (; nBox; nBox--, pBox++) {
+		int dst_y, height, st_y;
+
+		dst_y = pBox->y1 + dy;
+		height = pBox->y2 - pBox->y1;
+		modulus(dst_y - oy, sh, st_y);
+
+		while (height > 0) {
+			int dst_x, width, st_x, h;
+
+			dst_x = pBox->x1 + dx;
+			width = pBox->x2 - pBox->x1;
+			modulus(dst_x - ox, sw, st_x);
+
+			h = min(sh - st_y, height);
+			height -= h;
+
+			while (width > 0) {
+				gcsRECT src, dst;
+				int w;
+
+				w = min(sw - st_x, width);
+				width -= w;
+
+				src.left = st_x;
+				src.top = st_y;
+				src.right = st_x + w;
+				src.bottom = st_y + h;
+				dst.left = dst_x;
+				dst.top = dst_y;
+				dst.right = dst_x + w;
+				dst.bottom = dst_y + h;
+
+				err = gco2D_MonoBlit(vivante->e2d, stream,
+						     &size, &src,
+						     gcvSURF_UNPACKED,
+						     gcvSURF_UNPACKED, &dst,
+						     fg_rop, bg_rop,
+						     vPix->format);
+				if (err != gcvSTATUS_OK)
+					goto error;
+
+				vivante_queued(vivante, &dst, 1);
+
+				dst_x += w;
+				st_x = 0;
+			}
+			dst_y += h;
+			st_y = 0;
+		}
+	}
+
+ error:
+	if (err != gcvSTATUS_OK)
+		vivante_error(vivante, "gco2D_MonoBlit", err);
+
+	err = vivante_set_transparency(vivante, gcv2D_OPAQUE, gcv2D_OPAQUE);
+	if (err != gcvSTATUS_OK)
+		vivante_error(vivante, "gco2D_SetTransparencyAdvanced", err);
+
+	vivante_batch_add(vivante, vPix, ACCESS_RW);
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
+/*
+ * Expand boxes of a bitmap into the destination through the 2D engine's
+ * monochrome source: set bits are drawn in fg using fg_rop.  Clear bits
+ * are drawn in bg using bg_rop for gcvSURF_OPAQUE, or left untouched
+ * for gcvSURF_SOURCE_MATCH.  Only the part of the bitmap covered by the
+ * boxes is converted and streamed.  The source of each box is offset by
+ * (src_dx, src_dy) in the bitmap, and the destination by (dst_dx, dst_dy).
+ */
+static Bool vivante_mono_blit(struct vivante *vivante,
+	struct vivante_pixmap *vDst, PixmapPtr pBitmap,
+	const BoxRec *pBox, int nBox, int src_dx, int src_dy,
+	int dst_dx, int dst_dy, Pixel fg, Pixel bg,
+	gctUINT8 fg_rop, gctUINT8 bg_rop, gceSURF_TRANSPARENCY transparency)
+{
+	const BoxRec *b;
+	BoxRec ext, area;
+	gcsPOINT size;
+	gcsRECT clip;
+	gceSTATUS err;
+	unsigned stride;
+	void *stream;
+	int i;
+
+	ext = pBox[0];
+	for (i = 1, b = pBox + 1; i < nBox; i++, b++) {
+		ext.x1 = min(ext.x1, b->x1);
+		ext.y1 = min(ext.y1, b->y1);
+		ext.x2 = max(ext.x2, b->x2);
+		ext.y2 = max(ext.y2, b->y2);
+	}
+
+	area.x1 = (ext.x1 + src_dx) & ~31;
+	area.y1 = ext.y1 + src_dy;
+	area.x2 = ext.x2 + src_dx;
+	area.y2 = ext.y2 + src_dy;
+	if (area.x1 < 0 || area.y1 < 0 ||
+	    area.x2 > pBitmap->drawable.width ||
+	    area.y2 > pBitmap->drawable.height)
+		return FALSE;
+
+	stream = vivante_bitmap_stream(vivante, pBitmap, &area, &stride);
+	if (!stream)
+		return FALSE;
+
+	if (!gal_prepare_gpu(vivante, vDst, GPU2D_Target))
+		return FALSE;
+
+	vivante_disable_alpha_blend(vivante);
+
+	RectBox(&clip, &ext, dst_dx, dst_dy);
+	err = vivante_set_clipping(vivante, &clip);
+	if (err) {
+		vivante_error(vivante, "gco2D_SetClipping", err);
+		return FALSE;
+	}
+
+	err = vivante_set_mono_source(vivante, fg, bg, transparency);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetMonochromeSource", err);
+		return FALSE;
+	}
+
+	size.x = stride * 8;
+	size.y = area.y2 - area.y1;
+
+	/* Make the source offsets relative to the streamed area */
+	src_dx -= area.x1;
+	src_dy -= area.y1;
+
+	for (; nBox; nBox--, pBox++) {
+		gcsRECT src, dst;
+
+		RectBox(&src, pBox, src_dx, src_dy);
+		RectBox(&dst, pBox, dst_dx, dst_dy);
+
+		err = gco2D_MonoBlit(vivante->e2d, stream, &size, &src,
+				     gcvSURF_UNPACKED, gcvSURF_UNPACKED, &dst,
+				     fg_rop, bg_rop, vDst->format);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gco2D_MonoBlit", err);
+			break;
+		}
+
+		vivante_queued(vivante, &dst, 1);
+	}
+
+	err = vivante_set_transparency(vivante, gcv2D_OPAQUE, gcv2D_OPAQUE);
+	if (err != gcvSTATUS_OK)
+		vivante_error(vivante, "gco2D_SetTransparencyAdvanced", err);
+
+	vivante_batch_add(vivante, vDst, ACCESS_RW);
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
+static Bool vivante_fill_brush(struct vivante *vivante,
+	struct vivante_pixmap *vPix, const BoxRec *clipBox,
+	const BoxRec *pBox, unsigned nBox, int dx, int dy,
+	gctUINT8 rop, gctUINT8 bg_rop);
+
+/*
+ * Generic solid-like blit fill - takes a set of boxes, and fills them
+ * according to the clips in the GC.
+ */
+static Bool vivante_fill(struct vivante *vivante, struct vivante_pixmap *vPix,
+	DrawablePtr pDrawable, GCPtr pGC, const BoxRec *clipBox,
+	const BoxRec *pBox, unsigned nBox, int dx, int dy)
+{
+	gceSTATUS err;
+	gctUINT8 rop, bg_rop;
+	Bool stippled, ret;
+
+	stippled = pGC->fillStyle == FillStippled ||
+		   pGC->fillStyle == FillOpaqueStippled;
+	if (stippled && (pGC->stipple->drawable.width != 8 ||
+			 pGC->stipple->drawable.height != 8))
+		return vivante_fill_mono(vivante, vPix, pDrawable, pGC,
+					 clipBox, pBox, nBox, dx, dy);
+
+	rop = bg_rop = vivante_fill_rop[pGC->alu];
+
+	if (stippled) {
+		uint64_t bits;
+
+		/* 8x8 stipples are loaded as a monochrome brush */
+		bits = vivante_stipple_brush(pGC->stipple,
+					     pDrawable->x + pGC->patOrg.x + dx,
+					     pDrawable->y + pGC->patOrg.y + dy);
+		err = vivante_load_mono_brush(vivante, pGC->fgPixel,
+					      pGC->bgPixel, bits);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gco2D_LoadMonochromeBrush", err);
+			return FALSE;
+		}
+
+		/*
+		 * For FillStippled, mask the pattern so that clear stipple
+		 * bits leave the destination untouched.  If the engine will
+		 * not take that, leave the fill to fb.
+		 */
+		if (pGC->fillStyle == FillStippled) {
+			bg_rop = 0xaa;
+			err = vivante_set_transparency(vivante, gcv2D_OPAQUE,
+						       gcv2D_MASKED);
+			if (err != gcvSTATUS_OK) {
+				vivante_error(vivante,
+					      "gco2D_SetTransparencyAdvanced", err);
+				return FALSE;
+			}
+		}
+	} else {
+		err = vivante_load_solid_brush(vivante, vPix->format,
+					       vivante_fg_col(pGC));
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gco2D_LoadSolidBrush", err);
+			return FALSE;
+		}
+	}
+
+	ret = vivante_fill_brush(vivante, vPix, clipBox, pBox, nBox, dx, dy,
+				 rop, bg_rop);
+
+	err = vivante_set_transparency(vivante, gcv2D_OPAQUE, gcv2D_OPAQUE);
+	if (err != gcvSTATUS_OK)
+		vivante_error(vivante, "gco2D_SetTransparencyAdvanced", err);
+
+	return ret;
+}
+
+/*
+ * Fill the boxes using the currently loaded brush, with the boxes
+ * translated by dx, dy and clipped to clipBox.
+ */
+static Bool vivante_fill_brush(struct vivante *vivante,
+	struct vivante_pixmap *vPix, const BoxRec *clipBox,
+	const BoxRec *pBox, unsigned nBox, int dx, int dy,
+	gctUINT8 rop, gctUINT8 bg_rop)
+{
+	const BoxRec *b;
+	unsigned chunk;
+	gceSTATUS err;
 	gcsRECT *rects, *r, clip;
 
 	chunk = vivante->max_rect_count;
 	if (nBox < chunk)
 		chunk = nBox;
 
-	rects = malloc(chunk * sizeof *rects);
+	rects = vivante_scratch_alloc(&vivante->scratch, chunk * sizeof *rects);
 	if (!rects) {
 		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
 			   "[vivante] %s: %s failed\n", __FUNCTION__, "malloc rects");
 		return FALSE;
 	}
 
-	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target)) {
-		free(rects);
+	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target))
 		return FALSE;
-	}
 
 	vivante_disable_alpha_blend(vivante);
 
 	RectBox(&clip, clipBox, dx, dy);
-	err = gco2D_SetClipping(vivante->e2d, &clip);
+	err = vivante_set_clipping(vivante, &clip);
 	if (err) {
 		vivante_error(vivante, "gco2D_SetClipping", err);
-		free(rects);
 		return FALSE;
 	}
 
-	fg = vivante_fg_col(pGC);
-	err = gco2D_LoadSolidBrush(vivante->e2d, vPix->format, 0, fg, ~0ULL);
-	if (err != gcvSTATUS_OK) {
-		vivante_error(vivante, "gco2D_LoadSolidBrush", err);
-		free(rects);
-		return FALSE;
-	}
-
-	rop = vivante_fill_rop[pGC->alu];
 	b = pBox;
 	while (nBox) {
 		unsigned i;
@@ -500,43 +1467,49 @@ static Bool vivante_fill(struct vivante *vivante, struct vivante_pixmap *vPix,
 		for (i = 0, r = rects; i < chunk; i++, r++, b++)
 			RectBox(r, b, dx, dy);
 
-		err = gco2D_Blit(vivante->e2d, chunk, rects, rop, rop, vPix->format);
+		err = gco2D_Blit(vivante->e2d, chunk, rects, rop, bg_rop,
+				 vPix->format);
 		if (err)
 			break;
 
+		vivante_queued(vivante, rects, chunk);
+
 		nBox -= chunk;
 	}
-	free(rects);
 
 	if (err != gcvSTATUS_OK)
 		vivante_error(vivante, "Blit", err);
 
-	vivante_batch_add(vivante, vPix);
-	vivante_flush(vivante);
+	vivante_batch_add(vivante, vPix, ACCESS_RW);
+	vivante_submit(vivante);
 
 	return TRUE;
 }
 
 
-static const gctUINT8 vivante_copy_rop[] = {
-	/* GXclear        */  0x00,		// ROP_BLACK,
-	/* GXand          */  0x88,		// ROP_DST_AND_SRC,
-	/* GXandReverse   */  0x44,		// ROP_SRC_AND_NOT_DST,
-	/* GXcopy         */  0xcc,		// ROP_SRC,
-	/* GXandInverted  */  0x22,		// ROP_NOT_SRC_AND_DST,
-	/* GXnoop         */  0xaa,		// ROP_DST,
-	/* GXxor          */  0x66,		// ROP_DST_XOR_SRC,
-	/* GXor           */  0xee,		// ROP_DST_OR_SRC,
-	/* GXnor          */  0x11,		// ROP_NOT_SRC_AND_NOT_DST,
-	/* GXequiv        */  0x99,		// ROP_NOT_SRC_XOR_DST,
-	/* GXinvert       */  0x55,		// ROP_NOT_DST,
-	/* GXorReverse    */  0xdd,		// ROP_SRC_OR_NOT_DST,
-	/* GXcopyInverted */  0x33,		// ROP_NOT_SRC,
-	/* GXorInverted   */  0xbb,		// ROP_NOT_SRC_OR_DST,
-	/* GXnand         */  0x77,		// ROP_NOT_SRC_OR_NOT_DST,
-	/* GXset          */  0xff		// ROP_WHITE
-};
+static gceSTATUS vivante_blit_copy_rects(struct vivante *vivante,
+	gcsRECT_PTR clip, gcsRECT_PTR src, gcsRECT_PTR dst, unsigned n,
+	gctUINT8 rop, gceSURF_FORMAT format)
+{
+	gceSTATUS err;
+
+	err = vivante_set_clipping(vivante, clip);
+	if (err != gcvSTATUS_OK)
+		return err;
+
+	err = gco2D_BatchBlit(vivante->e2d, n, src, dst, rop, rop, format);
+	if (err == gcvSTATUS_OK)
+		vivante_queued(vivante, dst, n);
+
+	return err;
+}
 
+/*
+ * Copy the boxes, clipped against 'total', from the current source to
+ * the current target.  The boxes are clipped in software, so we gather
+ * them into source and destination rectangle arrays, and submit each
+ * max_rect_count chunk with a single clipping setup and BatchBlit.
+ */
 static gceSTATUS
 vivante_blit_copy(struct vivante *vivante, GCPtr pGC, const BoxRec *total,
 	const BoxRec *pbox, int nbox,
@@ -545,31 +1518,60 @@ vivante_blit_copy(struct vivante *vivante, GCPtr pGC, const BoxRec *total,
 {
 	gctUINT8 rop = vivante_copy_rop[pGC ? pGC->alu : GXcopy];
 	gceSTATUS err = gcvSTATUS_OK;
+	gcsRECT *rects, *src, *dst, clip;
+	unsigned chunk, n;
+
+	if (nbox <= 0)
+		return gcvSTATUS_OK;
+
+	chunk = vivante->max_rect_count;
+	if (nbox < chunk)
+		chunk = nbox;
+
+	rects = vivante_scratch_alloc(&vivante->scratch,
+				      2 * chunk * sizeof *rects);
+	if (!rects)
+		return gcvSTATUS_OUT_OF_MEMORY;
+
+	src = rects;
+	dst = rects + chunk;
 
-	for (; nbox; nbox--, pbox++) {
+	for (n = 0; nbox; nbox--, pbox++) {
 		BoxRec clipped;
-		gcsRECT src, dst;
 
 		if (BoxClip(&clipped, total, pbox))
 			continue;
 
-		RectBox(&src, &clipped, src_off_x, src_off_y);
-		RectBox(&dst, &clipped, dst_off_x, dst_off_y);
+		RectBox(&src[n], &clipped, src_off_x, src_off_y);
+		RectBox(&dst[n], &clipped, dst_off_x, dst_off_y);
 
-		err = gco2D_SetClipping(vivante->e2d, &dst);
-		if (err != gcvSTATUS_OK)
-			break;
+		/* The clip is the extents of the destination rectangles */
+		if (n == 0) {
+			clip = dst[0];
+		} else {
+			clip.left = min(clip.left, dst[n].left);
+			clip.top = min(clip.top, dst[n].top);
+			clip.right = max(clip.right, dst[n].right);
+			clip.bottom = max(clip.bottom, dst[n].bottom);
+		}
 
-		err = gco2D_BatchBlit(vivante->e2d, 1, &src, &dst, rop, rop, format);
-		if (err != gcvSTATUS_OK)
-			break;
+		if (++n == chunk) {
+			err = vivante_blit_copy_rects(vivante, &clip, src, dst,
+						      n, rop, format);
+			if (err != gcvSTATUS_OK)
+				break;
+			n = 0;
+		}
 	}
 
+	if (n && err == gcvSTATUS_OK)
+		err = vivante_blit_copy_rects(vivante, &clip, src, dst, n,
+					      rop, format);
+
 	return err;
 }
 
 
-
 Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	DDXPointPtr ppt, int *pwidth, int fSorted)
 {
@@ -577,7 +1579,9 @@ Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	struct vivante_pixmap *vPix;
 	PixmapPtr pPix;
 	BoxPtr pBox, p;
+	RegionPtr clip;
 	RegionRec region;
+	unsigned long pixels = 0;
 	int i, off_x, off_y;
 	Bool ret, overlap;
 
@@ -586,10 +1590,49 @@ Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	if (!vPix)
 		return FALSE;
 
-	pBox = malloc(n * sizeof *pBox);
+	for (i = 0; i < n; i++)
+		pixels += pwidth[i];
+	if (vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_FILL, pixels))
+		return FALSE;
+
+	pBox = vivante_scratch_alloc(&vivante->scratch, n * sizeof *pBox);
 	if (!pBox)
 		return FALSE;
 
+	clip = fbGetCompositeClip(pGC);
+	if (RegionNumRects(clip) == 1) {
+		const BoxRec *c = RegionExtents(clip);
+
+		/*
+		 * A single clip rectangle: clip the spans directly rather
+		 * than building and sorting a region from them.
+		 */
+		for (i = n, p = pBox; i; i--, ppt++, pwidth++) {
+			int x1 = ppt->x, x2 = x1 + *pwidth, y = ppt->y;
+
+			if (y < c->y1 || y >= c->y2)
+				continue;
+			if (x1 < c->x1)
+				x1 = c->x1;
+			if (x2 > c->x2)
+				x2 = c->x2;
+			if (x1 >= x2)
+				continue;
+
+			p->x1 = x1;
+			p->x2 = x2;
+			p->y1 = y;
+			p->y2 = y + 1;
+			p++;
+		}
+
+		if (p == pBox)
+			return TRUE;
+
+		return vivante_fill(vivante, vPix, pDrawable, pGC, c,
+				    pBox, p - pBox, off_x, off_y);
+	}
+
 	for (i = n, p = pBox; i; i--, p++, ppt++, pwidth++) {
 		p->x1 = ppt->x;
 		p->x2 = p->x1 + *pwidth;
@@ -599,7 +1642,6 @@ Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 
 	/* Convert the boxes to a region */
 	RegionInitBoxes(&region, pBox, n);
-	free(pBox);
 
 	if (!fSorted)
 		RegionValidate(&region, &overlap);
@@ -607,120 +1649,535 @@ Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	/* Intersect them with the clipping region */
 	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
 
-	ret = vivante_fill(vivante, vPix, pGC, RegionExtents(&region),
-			   RegionRects(&region), RegionNumRects(&region),
-			   off_x, off_y);
+	ret = vivante_fill(vivante, vPix, pDrawable, pGC,
+			   RegionExtents(&region), RegionRects(&region),
+			   RegionNumRects(&region), off_x, off_y);
 
 	RegionUninit(&region);
 
 	return ret;
 }
 
-Bool vivante_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
-	int x, int y, int w, int h, int leftPad, int format, char *bits)
+/*
+ * PutImage staging.  Images are copied into one of a ring of slots in
+ * a GPU-mapped buffer and blitted from there, so PutImage doesn't have
+ * to wait for the GPU.  Each slot carries a signal which galcore raises
+ * once the commit containing the slot's blits has executed; a slot is
+ * only rewritten once its signal has been raised.
+ */
+static Bool vivante_staging_init(struct vivante *vivante)
 {
-	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
-	struct vivante_pixmap *vPix;
-	RegionPtr pClip = fbGetCompositeClip(pGC);
-	PixmapPtr pPix;
-	BoxRec total;
-	unsigned pitch, size;
-	int dst_off_x, dst_off_y, off, src_off_x, src_off_y;
-	gctPOINTER info;
-	gctUINT32 addr;
-	gceSTATUS err;
-	char *buf = bits;
-
-	if (format != ZPixmap)
-		return FALSE;
+	struct vivante_staging *st = &vivante->staging;
+	unsigned i;
 
-	pPix = vivante_drawable_pixmap_deltas(pDrawable, &dst_off_x, &dst_off_y);
-	vPix = vivante_get_pixmap_priv(pPix);
-	if (!vPix)
+	st->bo = drm_armada_bo_dumb_create(vivante->bufmgr, 1024,
+			VIVANTE_STAGING_SLOTS * VIVANTE_STAGING_SLOT_SIZE /
+			(1024 * sizeof(uint32_t)), 32);
+	if (!st->bo) {
+		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
+			   "vivante: unable to create staging bo: %s\n",
+			   strerror(errno));
 		return FALSE;
+	}
 
-	pitch = PixmapBytePad(w, depth);
+	if (drm_armada_bo_map(st->bo)) {
+		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
+			   "vivante: unable to map staging bo: %s\n",
+			   strerror(errno));
+		goto put_bo;
+	}
 
-	/*
-	 * If the image is not appropriately aligned on each scanline, align
-	 * it - it's cheaper to align it here, than to fall back and copy it
-	 * manually to the scanout buffer.  It is unfortunate that we can't
-	 * tell the X server/clients about this restriction.
-	 */
-	if (pitch & 15) {
-		unsigned i, new_pitch = (pitch + 15) & ~15;
+	if (!vivante_map_bo_to_gpu(vivante, st->bo, &st->info, &st->handle))
+		goto put_bo;
 
-		buf = malloc(new_pitch * h);
-		if (!buf)
-			return FALSE;
+	for (i = 0; i < VIVANTE_STAGING_SLOTS; i++) {
+		struct vivante_staging_slot *slot = &st->slot[i];
 
-		for (i = 0; i < h; i++) {
-			memcpy(buf + new_pitch * i, bits + pitch * i, pitch);
-			memset(buf + new_pitch * i + pitch, 0, new_pitch - pitch);
-		}
+		slot->ptr = (char *)st->bo->ptr + i * VIVANTE_STAGING_SLOT_SIZE;
+		slot->handle = st->handle + i * VIVANTE_STAGING_SLOT_SIZE;
 
-		pitch = new_pitch;
+		/*
+		 * If we can't get a signal, we fall back to stalling
+		 * when the slot is reused.
+		 */
+		if (gcoOS_CreateSignal(vivante->os, gcvFALSE,
+				       &slot->signal) != gcvSTATUS_OK)
+			slot->signal = NULL;
 	}
 
-	size = pitch * h;
+	return TRUE;
+
+ put_bo:
+	drm_armada_bo_put(st->bo);
+	st->bo = NULL;
+	return FALSE;
+}
+
+/* The GPU must be idle when this is called */
+static void vivante_staging_fini(struct vivante *vivante)
+{
+	struct vivante_staging *st = &vivante->staging;
+	unsigned i;
+
+	if (!st->bo)
+		return;
+
+	for (i = 0; i < VIVANTE_STAGING_SLOTS; i++)
+		if (st->slot[i].signal)
+			gcoOS_DestroySignal(vivante->os, st->slot[i].signal);
+
+	vivante_unmap_from_gpu(vivante, st->info, st->handle);
+	drm_armada_bo_put(st->bo);
+	st->bo = NULL;
+}
+
+/* Get the next slot in the ring, waiting for the GPU to finish with it */
+static struct vivante_staging_slot *vivante_staging_get(
+	struct vivante *vivante)
+{
+	struct vivante_staging *st = &vivante->staging;
+	struct vivante_staging_slot *slot = &st->slot[st->next];
+
+	st->next = (st->next + 1) % VIVANTE_STAGING_SLOTS;
+
+	if (slot->busy) {
+		st->waits++;
+
+		if (!slot->signal) {
+			vivante_commit(vivante, TRUE);
+		} else {
+			gceSTATUS err;
+
+			/* The signal event must be submitted before waiting */
+			if ((int32_t)(slot->serial - st->committed) > 0)
+				vivante_commit(vivante, FALSE);
+
+			err = gcoOS_WaitSignal(vivante->os, slot->signal,
+					       gcvINFINITE);
+			if (err != gcvSTATUS_OK) {
+				vivante_error(vivante, "gcoOS_WaitSignal", err);
+				vivante_commit(vivante, TRUE);
+			}
+		}
+		slot->busy = FALSE;
+	}
+
+	return slot;
+}
+
+/* Mark the slot busy until the GPU has executed the blits queued so far */
+static void vivante_staging_put(struct vivante *vivante,
+	struct vivante_staging_slot *slot)
+{
+	struct vivante_staging *st = &vivante->staging;
+
+	slot->busy = TRUE;
+	slot->serial = ++st->serial;
+
+	if (slot->signal) {
+		gcsHAL_INTERFACE iface;
+		gceSTATUS err;
+
+		memset(&iface, 0, sizeof(iface));
+		iface.command = gcvHAL_SIGNAL;
+		iface.u.Signal.signal = slot->signal;
+		iface.u.Signal.auxSignal = gcvNULL;
+		iface.u.Signal.process = gcoOS_GetCurrentProcessID();
+		iface.u.Signal.fromWhere = gcvKERNEL_PIXEL;
+
+		err = gcoHAL_ScheduleEvent(vivante->hal, &iface);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gcoHAL_ScheduleEvent", err);
+			gcoOS_DestroySignal(vivante->os, slot->signal);
+			slot->signal = NULL;
+		}
+	}
+}
+
+/*
+ * Upload the image through the staging ring.  Images larger than a
+ * slot are split into bands of rows; each band is committed once it
+ * is queued, so the GPU blits it while the next band is copied.  Once
+ * a band has been queued we must not return FALSE, as fb would then
+ * draw those rows a second time: should a later band fail, the rows
+ * from it onwards are drawn by fb instead.
+ */
+Bool vivante_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
+	int x, int y, int w, int h, int leftPad, int format, char *bits)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	struct vivante_pixmap *vPix;
+	RegionPtr pClip = fbGetCompositeClip(pGC);
+	PixmapPtr pPix;
+	unsigned pitch, slot_pitch, band_h;
+	int dst_off_x, dst_off_y, band_y;
+	gceSTATUS err;
 
-	err = gcoOS_MapUserMemory(vivante->os, buf, size, &info, &addr);
-	if (err)
+	if (format != ZPixmap || !vivante->staging.bo)
 		return FALSE;
 
-	/* Get the 'X' offset required to align the supplied data */
-	off = addr & VIVANTE_ALIGN_MASK;
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &dst_off_x, &dst_off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix)
+		return FALSE;
+
+	if (vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_PUTIMAGE,
+				w * h))
+		return FALSE;
+
+	/*
+	 * The GPU needs a 16-byte aligned pitch; it is cheaper to realign
+	 * the rows while copying them into the slot than to fall back.
+	 */
+	pitch = PixmapBytePad(w, depth);
+	slot_pitch = (pitch + 15) & ~15;
+	band_h = VIVANTE_STAGING_SLOT_SIZE / slot_pitch;
+	if (band_h == 0)
+		return FALSE;
 
 	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target))
+		return FALSE;
+
+	vivante->staging.uploads++;
+
+	for (band_y = 0; band_y < h; band_y += band_h) {
+		struct vivante_staging_slot *slot;
+		unsigned i, bh = min(band_h, (unsigned)(h - band_y));
+		const char *src = bits + band_y * pitch;
+		char *dst;
+		BoxRec total;
+
+		slot = vivante_staging_get(vivante);
+
+		vivante_disable_alpha_blend(vivante);
+
+		err = vivante_set_source(vivante, slot->handle, slot_pitch,
+					 vPix->format, w, bh);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "SetColorSourceAdvanced", err);
+			vivante_staging_put(vivante, slot);
+			if (band_y == 0)
+				return FALSE;
+			vivante_submit(vivante);
+			vivante_unaccel_PutImage(pDrawable, pGC, depth, x,
+						 y + band_y, w, h - band_y,
+						 leftPad, format,
+						 bits + band_y * pitch);
+			return TRUE;
+		}
+
+		dst = slot->ptr;
+
+		if (slot_pitch == pitch) {
+			memcpy(dst, src, pitch * bh);
+		} else {
+			for (i = 0; i < bh; i++, dst += slot_pitch, src += pitch)
+				memcpy(dst, src, pitch);
+		}
+
+		total.x1 = pDrawable->x + x;
+		total.y1 = pDrawable->y + y + band_y;
+		total.x2 = total.x1 + w;
+		total.y2 = total.y1 + bh;
+
+		err = vivante_blit_copy(vivante, pGC, &total, REGION_RECTS(pClip),
+					REGION_NUM_RECTS(pClip), -total.x1,
+					-total.y1, dst_off_x, dst_off_y,
+					vPix->format);
+		if (err != gcvSTATUS_OK)
+			vivante_error(vivante, "Blit", err);
+
+		vivante_batch_add(vivante, vPix, ACCESS_RW);
+		vivante_staging_put(vivante, slot);
+		vivante->staging.bands++;
+
+		/* Start the GPU on this band while we copy the next */
+		if (band_y + bh < h)
+			vivante_commit(vivante, FALSE);
+	}
+
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
+/*
+ * Reading GPU pixmaps directly with the CPU is slow, as they are mapped
+ * write-combined or uncached.  For anything but small reads, blit the
+ * boxes into cacheable staging memory mapped to the GPU instead, and
+ * copy them out from there.  This is the reverse of PutImage above.
+ */
+
+/*
+ * The readback buffer is a SHMEM bo, and so cacheable.  It stays
+ * mapped to the GPU, and after each read its CPU caches are
+ * invalidated.  If the kernel can't do that, the buffer is unmapped
+ * instead, which lets galcore do it, and is mapped again for the next
+ * read.  The GPU must be idle for the buffer when these are called.
+ */
+static void vivante_readback_unmap(struct vivante *vivante)
+{
+	struct vivante_readback *rb = &vivante->readback;
+
+	if (rb->info) {
+		gcoOS_UnmapUserMemory(vivante->os, rb->bo->ptr, rb->bo->size,
+				      rb->info, rb->handle);
+		rb->info = NULL;
+	}
+}
+
+static void vivante_readback_fini(struct vivante *vivante)
+{
+	struct vivante_readback *rb = &vivante->readback;
+
+	vivante_readback_unmap(vivante);
+	if (rb->bo) {
+		drm_armada_bo_put(rb->bo);
+		rb->bo = NULL;
+	}
+}
+
+static Bool vivante_readback_get(struct vivante *vivante, size_t size)
+{
+	struct vivante_readback *rb = &vivante->readback;
+	gctUINT32 addr;
+	gceSTATUS err;
+
+	if (rb->bo && rb->bo->size < size) {
+		size = max(size, min(2 * rb->bo->size, VIVANTE_READBACK_MAX));
+		vivante_readback_fini(vivante);
+	}
+
+	if (!rb->bo) {
+		/* Rows of 4096 bytes, rounding the size up to whole pages */
+		rb->bo = drm_armada_bo_create(vivante->bufmgr, 1024,
+					      (size + 4095) / 4096, 32);
+		if (!rb->bo)
+			return FALSE;
+
+		if (drm_armada_bo_map(rb->bo)) {
+			drm_armada_bo_put(rb->bo);
+			rb->bo = NULL;
+			return FALSE;
+		}
+		rb->grows++;
+	}
+
+	if (!rb->info) {
+		err = gcoOS_MapUserMemory(vivante->os, rb->bo->ptr,
+					  rb->bo->size, &rb->info, &addr);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "gcoOS_MapUserMemory", err);
+			rb->info = NULL;
+			return FALSE;
+		}
+		rb->handle = addr;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Read back the boxes (in pixmap coordinates) stacked one below the
+ * other into 'd', each row padded as for a ZPixmap image.  Reads
+ * larger than VIVANTE_READBACK_MAX use a one-off mapping of malloc'd
+ * memory rather than the readback buffer.
+ */
+static Bool vivante_readback(struct vivante *vivante, PixmapPtr pPix,
+	struct vivante_pixmap *vPix, const BoxRec *pBox, unsigned nBox, char *d)
+{
+	struct vivante_readback *rb = &vivante->readback;
+	unsigned cpp = pPix->drawable.bitsPerPixel / 8;
+	unsigned i, pitch, size, width = 0, height = 0;
+	gcsRECT *src, *dst, clip;
+	gctPOINTER info;
+	gctUINT32 addr;
+	gceSTATUS err;
+	char *buf, *s;
+	Bool oneoff;
+	int off, y;
+
+	for (i = 0; i < nBox; i++) {
+		if (pBox[i].x1 < 0 || pBox[i].y1 < 0 ||
+		    pBox[i].x2 > pPix->drawable.width ||
+		    pBox[i].y2 > pPix->drawable.height)
+			return FALSE;
+
+		width = max(width, (unsigned)(pBox[i].x2 - pBox[i].x1));
+		height += pBox[i].y2 - pBox[i].y1;
+	}
+
+	pitch = (width * cpp + 15) & ~15;
+	size = pitch * height;
+
+	src = vivante_scratch_alloc(&vivante->scratch, 2 * nBox * sizeof *src);
+	if (!src)
+		return FALSE;
+	dst = src + nBox;
+
+	oneoff = size > VIVANTE_READBACK_MAX;
+	if (oneoff) {
+		buf = malloc(size);
+		if (!buf)
+			return FALSE;
+
+		err = gcoOS_MapUserMemory(vivante->os, buf, size, &info, &addr);
+		if (err) {
+			free(buf);
+			return FALSE;
+		}
+		rb->oneoff++;
+	} else {
+		if (!vivante_readback_get(vivante, size))
+			return FALSE;
+
+		buf = rb->bo->ptr;
+		info = rb->info;
+		addr = rb->handle;
+	}
+	rb->reads++;
+
+	/* Get the 'X' offset required to align the staging memory */
+	off = addr & VIVANTE_ALIGN_MASK;
+
+	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Source))
 		goto unmap;
 
 	vivante_disable_alpha_blend(vivante);
 
-	err = gco2D_SetColorSourceAdvanced(vivante->e2d, addr - off, pitch,
-			  vPix->format, gcvSURF_0_DEGREE, w, h, gcvFALSE);
+	err = vivante_set_target(vivante, addr - off, pitch);
 	if (err != gcvSTATUS_OK) {
-		vivante_error(vivante, "SetColorSourceAdvanced", err);
+		vivante_error(vivante, "gco2D_SetTarget", err);
 		goto unmap;
 	}
 
-	x += pDrawable->x;
-	y += pDrawable->y;
-
-	total.x1 = x;
-	total.y1 = y;
-	total.x2 = x + w;
-	total.y2 = y + h;
-	src_off_x = -x + off * 8 / BitsPerPixel(depth);
-	src_off_y = -y;
+	for (i = 0, y = 0; i < nBox; i++) {
+		RectBox(&src[i], &pBox[i], 0, 0);
+		dst[i].left = off / cpp;
+		dst[i].top = y;
+		dst[i].right = dst[i].left + src[i].right - src[i].left;
+		dst[i].bottom = y + src[i].bottom - src[i].top;
+		y = dst[i].bottom;
+	}
 
-	err = vivante_blit_copy(vivante, pGC, &total, REGION_RECTS(pClip),
-				REGION_NUM_RECTS(pClip), src_off_x, src_off_y,
-				dst_off_x, dst_off_y, vPix->format);
-	if (err != gcvSTATUS_OK)
-		vivante_error(vivante, "Blit", err);
+	clip.left = off / cpp;
+	clip.top = 0;
+	clip.right = clip.left + width;
+	clip.bottom = height;
 
-	vivante_batch_add(vivante, vPix);
+	for (i = 0; i < nBox; i += vivante->max_rect_count) {
+		unsigned n = min(nBox - i, vivante->max_rect_count);
 
-	/* Ask for the memory to be unmapped upon completion */
-	gcoHAL_ScheduleUnmapUserMemory(vivante->hal, info, size, addr, buf);
+		err = vivante_blit_copy_rects(vivante, &clip, src + i, dst + i,
+					      n, 0xcc, vPix->format);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "Blit", err);
+			break;
+		}
+	}
 
-	/* We have to wait for this blit to finish... */
-	vivante_batch_wait_commit(vivante, vPix);
+	/* The staging memory is not a pixmap: wait for all access */
+	vivante_batch_add(vivante, vPix, ACCESS_RO);
+	vivante_batch_wait_commit(vivante, vPix, ACCESS_RW);
+
+	/* Make the GPU writes visible to the CPU */
+	if (oneoff)
+		gcoOS_UnmapUserMemory(vivante->os, buf, size, info, addr);
+	else if (!vivante_bo_cache_maint(vivante, rb->bo, size, OP_USER_INV))
+		vivante_readback_unmap(vivante);
+
+	if (err == gcvSTATUS_OK) {
+		for (i = 0, s = buf; i < nBox; i++) {
+			unsigned w = pBox[i].x2 - pBox[i].x1;
+			unsigned dpitch = PixmapBytePad(w, pPix->drawable.depth);
+
+			for (y = pBox[i].y1; y < pBox[i].y2; y++) {
+				memcpy(d, s, w * cpp);
+				d += dpitch;
+				s += pitch;
+			}
+		}
+	}
 
-	/* And free the buffer we may have allocated */
-	if (buf != bits)
+	if (oneoff)
 		free(buf);
 
-	return TRUE;
+	return err == gcvSTATUS_OK;
 
  unmap:
-	gcoOS_UnmapUserMemory(vivante->os, buf, size, info, addr);
-	if (buf != bits)
+	if (oneoff) {
+		gcoOS_UnmapUserMemory(vivante->os, buf, size, info, addr);
 		free(buf);
+	}
 
 	return FALSE;
 }
 
+Bool vivante_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+	unsigned int format, unsigned long planeMask, char *d)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	struct vivante_pixmap *vPix;
+	PixmapPtr pPix;
+	BoxRec box;
+	int off_x, off_y;
+
+	if (format != ZPixmap ||
+	    (planeMask & FbFullMask(pDrawable->depth)) !=
+	    FbFullMask(pDrawable->depth))
+		return FALSE;
+
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix || pPix->drawable.bitsPerPixel < 8 ||
+	    vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_READBACK,
+				w * h))
+		return FALSE;
+
+	box.x1 = x + pDrawable->x + off_x;
+	box.y1 = y + pDrawable->y + off_y;
+	box.x2 = box.x1 + w;
+	box.y2 = box.y1 + h;
+
+	return vivante_readback(vivante, pPix, vPix, &box, 1, d);
+}
+
+Bool vivante_accel_GetSpans(DrawablePtr pDrawable, int wMax, DDXPointPtr ppt,
+	int *pwidth, int nspans, char *pdstStart)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	struct vivante_pixmap *vPix;
+	PixmapPtr pPix;
+	BoxPtr box;
+	unsigned long total = 0;
+	int i, off_x, off_y;
+
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix || pPix->drawable.bitsPerPixel < 8)
+		return FALSE;
+
+	for (i = 0; i < nspans; i++)
+		total += pwidth[i];
+	if (vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_READBACK,
+				total))
+		return FALSE;
+
+	box = vivante_scratch_alloc(&vivante->scratch, nspans * sizeof *box);
+	if (!box)
+		return FALSE;
+
+	/* Span points are in screen coordinates */
+	for (i = 0; i < nspans; i++) {
+		box[i].x1 = ppt[i].x + off_x;
+		box[i].y1 = ppt[i].y + off_y;
+		box[i].x2 = box[i].x1 + pwidth[i];
+		box[i].y2 = box[i].y1 + 1;
+	}
+
+	return vivante_readback(vivante, pPix, vPix, box, nspans, pdstStart);
+}
+
 void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
 	Bool upsidedown, Pixel bitPlane, void *closure)
@@ -729,8 +2186,10 @@ void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	struct vivante_pixmap *vSrc, *vDst;
 	PixmapPtr pixSrc, pixDst;
 	int dst_off_x, dst_off_y, src_off_x, src_off_y;
+	unsigned long pixels = 0;
 	BoxRec limits;
 	gceSTATUS err;
+	int i;
 
 	if (vivante->force_fallback)
 		goto fallback;
@@ -744,6 +2203,11 @@ void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	if (!vSrc || !vDst)
 		goto fallback;
 
+	for (i = 0; i < nBox; i++)
+		pixels += (pBox[i].x2 - pBox[i].x1) * (pBox[i].y2 - pBox[i].y1);
+	if (vivante_cpu_cheaper(vivante, vDst, vSrc, VIVANTE_OP_COPY, pixels))
+		goto fallback;
+
 	/* Include the copy delta on the source */
 	src_off_x += dx;
 	src_off_y += dy;
@@ -770,9 +2234,9 @@ void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	if (err != gcvSTATUS_OK)
 		vivante_error(vivante, "Blit", err);
 
-	vivante_batch_add(vivante, vSrc);
-	vivante_batch_add(vivante, vDst);
-	vivante_flush(vivante);
+	vivante_batch_add(vivante, vSrc, ACCESS_RO);
+	vivante_batch_add(vivante, vDst, ACCESS_RW);
+	vivante_submit(vivante);
 
 	return;
 
@@ -781,6 +2245,85 @@ void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 		upsidedown, bitPlane, closure);
 }
 
+/*
+ * CopyPlane from a bitmap: set bits become the GC foreground and clear
+ * bits the GC background, both combined with the destination by the GC
+ * function.  Bitmaps always live in system memory, so the source is
+ * expanded by streaming it through the monochrome source.
+ */
+void vivante_accel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst,
+	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
+	Bool upsidedown, Pixel bitPlane, void *closure)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDst->pScreen);
+	struct vivante_pixmap *vDst;
+	PixmapPtr pixSrc, pixDst;
+	int dst_off_x, dst_off_y, src_off_x, src_off_y;
+	gctUINT8 rop;
+
+	if (vivante->force_fallback)
+		goto fallback;
+
+	pixSrc = vivante_drawable_pixmap_deltas(pSrc, &src_off_x, &src_off_y);
+	pixDst = vivante_drawable_pixmap_deltas(pDst, &dst_off_x, &dst_off_y);
+
+	vDst = vivante_get_pixmap_priv(pixDst);
+	if (!vDst || vivante_get_pixmap_priv(pixSrc))
+		goto fallback;
+
+	rop = vivante_copy_rop[pGC->alu];
+
+	if (vivante_mono_blit(vivante, vDst, pixSrc, pBox, nBox,
+			      src_off_x + dx, src_off_y + dy,
+			      dst_off_x, dst_off_y,
+			      pGC->fgPixel, pGC->bgPixel, rop, rop,
+			      gcvSURF_OPAQUE))
+		return;
+
+ fallback:
+	vivante_unaccel_Copy1toN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
+		upsidedown, bitPlane, closure);
+}
+
+/*
+ * PushPixels with a solid fill: the bitmap selects which pixels of the
+ * destination are filled with the GC foreground.
+ */
+Bool vivante_accel_PushPixels(GCPtr pGC, PixmapPtr pBitmap,
+	DrawablePtr pDrawable, int w, int h, int x, int y)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	struct vivante_pixmap *vPix;
+	struct vivante_boxes out;
+	PixmapPtr pPix;
+	BoxRec box;
+	int off_x, off_y;
+
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix || vivante_get_pixmap_priv(pBitmap))
+		return FALSE;
+
+	/* The origin is in screen coordinates, as for fbPushPixels */
+	box.x1 = x;
+	box.y1 = y;
+	box.x2 = box.x1 + w;
+	box.y2 = box.y1 + h;
+
+	if (!vivante_boxes_init(vivante, &out, 1) ||
+	    !vivante_clip_boxes(vivante, fbGetCompositeClip(pGC), &box, 1, &out))
+		return FALSE;
+
+	if (out.n == 0)
+		return TRUE;
+
+	return vivante_mono_blit(vivante, vPix, pBitmap, out.box, out.n,
+				 -box.x1, -box.y1, off_x, off_y,
+				 pGC->fgPixel, 0,
+				 vivante_copy_rop[pGC->alu], 0xaa,
+				 gcvSURF_SOURCE_MATCH);
+}
+
 Bool vivante_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int npt, DDXPointPtr ppt)
 {
@@ -788,6 +2331,7 @@ Bool vivante_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	struct vivante_pixmap *vPix;
 	PixmapPtr pPix;
 	BoxPtr pBox;
+	RegionPtr clip;
 	RegionRec region;
 	int i, off_x, off_y;
 	Bool ret, overlap;
@@ -797,24 +2341,62 @@ Bool vivante_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	if (!vPix)
 		return FALSE;
 
-	pBox = malloc(npt * sizeof *pBox);
+	if (vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_FILL, npt))
+		return FALSE;
+
+	pBox = vivante_scratch_alloc(&vivante->scratch, npt * sizeof *pBox);
 	if (!pBox)
 		return FALSE;
 
-	if (mode == CoordModePrevious) {
+	clip = fbGetCompositeClip(pGC);
+	if (RegionNumRects(clip) == 1) {
+		const BoxRec *c = RegionExtents(clip);
+		BoxPtr p = pBox;
 		int x, y;
 
+		/* A single clip rectangle: drop the points outside it */
 		x = y = 0;
 		for (i = 0; i < npt; i++) {
-			x += ppt[i].x;
-			y += ppt[i].y;
-			pBox[i].x1 = x + pDrawable->x;
-			pBox[i].y1 = y + pDrawable->y;
-			pBox[i].x2 = pBox[i].x1 + 1;
-			pBox[i].y2 = pBox[i].y1 + 1;
+			if (mode == CoordModePrevious) {
+				x += ppt[i].x;
+				y += ppt[i].y;
+			} else {
+				x = ppt[i].x;
+				y = ppt[i].y;
+			}
+
+			p->x1 = x + pDrawable->x;
+			p->y1 = y + pDrawable->y;
+			if (p->x1 < c->x1 || p->x1 >= c->x2 ||
+			    p->y1 < c->y1 || p->y1 >= c->y2)
+				continue;
+
+			p->x2 = p->x1 + 1;
+			p->y2 = p->y1 + 1;
+			p++;
 		}
-	} else {
-		for (i = 0; i < npt; i++) {
+
+		if (p == pBox)
+			return TRUE;
+
+		return vivante_fill(vivante, vPix, pDrawable, pGC, c,
+				    pBox, p - pBox, off_x, off_y);
+	}
+
+	if (mode == CoordModePrevious) {
+		int x, y;
+
+		x = y = 0;
+		for (i = 0; i < npt; i++) {
+			x += ppt[i].x;
+			y += ppt[i].y;
+			pBox[i].x1 = x + pDrawable->x;
+			pBox[i].y1 = y + pDrawable->y;
+			pBox[i].x2 = pBox[i].x1 + 1;
+			pBox[i].y2 = pBox[i].y1 + 1;
+		}
+	} else {
+		for (i = 0; i < npt; i++) {
 			pBox[i].x1 = ppt[i].x + pDrawable->x;
 			pBox[i].y1 = ppt[i].y + pDrawable->y;
 			pBox[i].x2 = pBox[i].x1 + 1;
@@ -824,74 +2406,1001 @@ Bool vivante_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 
 	/* Convert the boxes to a region */
 	RegionInitBoxes(&region, pBox, npt);
-	free(pBox);
 
 	RegionValidate(&region, &overlap);
 
 	/* Intersect them with the clipping region */
 	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
 
-	ret = vivante_fill(vivante, vPix, pGC, RegionExtents(&region),
-			   RegionRects(&region), RegionNumRects(&region),
-			   off_x, off_y);
+	ret = vivante_fill(vivante, vPix, pDrawable, pGC,
+			   RegionExtents(&region), RegionRects(&region),
+			   RegionNumRects(&region), off_x, off_y);
 
 	RegionUninit(&region);
 
 	return ret;
 }
 
+/*
+ * Find the first box in a banded region whose band ends below y.  The
+ * bands are sorted, so y2 never decreases along the box array.
+ */
+static const BoxRec *vivante_clip_find_band(const BoxRec *box, int nbox,
+	int y)
+{
+	while (nbox > 0) {
+		int half = nbox / 2;
+
+		if (box[half].y2 <= y) {
+			box += half + 1;
+			nbox -= half + 1;
+		} else {
+			nbox = half;
+		}
+	}
+	return box;
+}
+
+/*
+ * A list of boxes in the scratch arena which doubles in size as boxes
+ * are added.  The superseded arrays are released with the arena.
+ */
+struct vivante_boxes {
+	BoxPtr box;
+	int n;
+	int size;
+};
+
+static Bool vivante_boxes_init(struct vivante *vivante,
+	struct vivante_boxes *b, int size)
+{
+	if (size < 16)
+		size = 16;
+
+	b->box = vivante_scratch_alloc(&vivante->scratch, size * sizeof *b->box);
+	b->n = 0;
+	b->size = size;
+
+	return b->box != NULL;
+}
+
+static Bool vivante_boxes_add(struct vivante *vivante,
+	struct vivante_boxes *b, int x1, int y1, int x2, int y2)
+{
+	BoxPtr box;
+
+	if (b->n >= b->size) {
+		box = vivante_scratch_alloc(&vivante->scratch,
+					    2 * b->size * sizeof *box);
+		if (!box)
+			return FALSE;
+		memcpy(box, b->box, b->n * sizeof *box);
+		b->box = box;
+		b->size *= 2;
+	}
+
+	box = &b->box[b->n++];
+	box->x1 = x1;
+	box->y1 = y1;
+	box->x2 = x2;
+	box->y2 = y2;
+
+	return TRUE;
+}
+
+/*
+ * Intersect each box with the clip region, appending the results to
+ * 'out'.  Each box is clipped to the clip extents, then only the bands
+ * which overlap it are walked, stopping each band once we pass its
+ * right hand edge.  Boxes are kept separate, so any overlaps between
+ * them are preserved as they would be by fb.
+ */
+static Bool vivante_clip_boxes(struct vivante *vivante, RegionPtr clip,
+	const BoxRec *in, int n, struct vivante_boxes *out)
+{
+	const BoxRec *ext = RegionExtents(clip);
+	const BoxRec *clip_box = RegionRects(clip);
+	const BoxRec *clip_end, *c;
+	int nclip = RegionNumRects(clip);
+
+	clip_end = clip_box + nclip;
+
+	for (; n; n--, in++) {
+		int x1, y1, x2, y2;
+
+		x1 = max(in->x1, ext->x1);
+		y1 = max(in->y1, ext->y1);
+		x2 = min(in->x2, ext->x2);
+		y2 = min(in->y2, ext->y2);
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		if (nclip == 1) {
+			if (!vivante_boxes_add(vivante, out, x1, y1, x2, y2))
+				return FALSE;
+			continue;
+		}
+
+		for (c = vivante_clip_find_band(clip_box, nclip, y1);
+		     c < clip_end && c->y1 < y2; c++) {
+			if (c->x2 <= x1)
+				continue;
+
+			if (c->x1 >= x2) {
+				while (c + 1 < clip_end && c[1].y1 == c->y1)
+					c++;
+				continue;
+			}
+
+			if (!vivante_boxes_add(vivante, out,
+					       max(x1, c->x1), max(y1, c->y1),
+					       min(x2, c->x2), min(y2, c->y2)))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 Bool vivante_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect)
 {
 	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
 	struct vivante_pixmap *vPix;
+	struct vivante_boxes out;
 	PixmapPtr pPix;
 	RegionPtr clip;
-	BoxPtr box;
-	BoxRec boxes[255], clipBox;
-	int off_x, off_y, nclip, nb;
-	Bool ret = TRUE;
+	BoxPtr boxes;
+	BoxRec clipBox;
+	unsigned long pixels = 0;
+	int off_x, off_y, nb;
+
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix)
+		return FALSE;
+
+	for (nb = 0; nb < n; nb++)
+		pixels += (unsigned long)prect[nb].width * prect[nb].height;
+	if (vivante_cpu_cheaper(vivante, vPix, NULL, VIVANTE_OP_FILL, pixels))
+		return FALSE;
+
+	clip = fbGetCompositeClip(pGC);
+	clipBox = *RegionExtents(clip);
+
+	boxes = vivante_scratch_alloc(&vivante->scratch, n * sizeof *boxes);
+	if (!boxes)
+		return FALSE;
+
+	/* Clip to the extents first, so the boxes can not overflow */
+	for (nb = 0; n--; prect++) {
+		int x1, y1, x2, y2;
+
+		x1 = max(prect->x + pDrawable->x, clipBox.x1);
+		y1 = max(prect->y + pDrawable->y, clipBox.y1);
+		x2 = min(prect->x + pDrawable->x + prect->width, clipBox.x2);
+		y2 = min(prect->y + pDrawable->y + prect->height, clipBox.y2);
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		boxes[nb].x1 = x1;
+		boxes[nb].y1 = y1;
+		boxes[nb].x2 = x2;
+		boxes[nb].y2 = y2;
+		nb++;
+	}
+
+	if (!vivante_boxes_init(vivante, &out, nb) ||
+	    !vivante_clip_boxes(vivante, clip, boxes, nb, &out))
+		return FALSE;
+
+	if (out.n == 0)
+		return TRUE;
+
+	return vivante_fill(vivante, vPix, pDrawable, pGC, &clipBox,
+			    out.box, out.n, off_x, off_y);
+}
+
+/*
+ * Convert a zero-width line into horizontal (x major) or vertical
+ * (y major) runs of pixels.  This uses the same Bresenham setup as
+ * mi and fb, including the screen's zero line bias, so the GPU fills
+ * exactly the pixels which fb would draw.
+ */
+#define LINE_XDECREASING	4
+#define LINE_YDECREASING	2
+#define LINE_YMAJOR		1
+
+static Bool vivante_line_runs(struct vivante *vivante,
+	struct vivante_boxes *b, unsigned bias, int x1, int y1, int x2, int y2,
+	Bool draw_last)
+{
+	int adx, ady, sdx, sdy, e, e1, e2, len, start;
+	unsigned octant = 0;
+
+	adx = x2 - x1;
+	sdx = 1;
+	if (adx < 0) {
+		adx = -adx;
+		sdx = -1;
+		octant |= LINE_XDECREASING;
+	}
+
+	ady = y2 - y1;
+	sdy = 1;
+	if (ady < 0) {
+		ady = -ady;
+		sdy = -1;
+		octant |= LINE_YDECREASING;
+	}
+
+	if (adx > ady) {
+		e1 = ady << 1;
+		e2 = e1 - (adx << 1);
+		e = e1 - adx;
+		len = adx;
+	} else {
+		e1 = adx << 1;
+		e2 = e1 - (ady << 1);
+		e = e1 - ady;
+		len = ady;
+		octant |= LINE_YMAJOR;
+	}
+
+	e -= (bias >> octant) & 1;
+
+	if (draw_last)
+		len++;
+
+	if (!(octant & LINE_YMAJOR)) {
+		for (start = x1; len--; ) {
+			Bool step = e >= 0;
+
+			if (step || len == 0) {
+				if (!vivante_boxes_add(vivante, b,
+						       min(start, x1), y1,
+						       max(start, x1) + 1,
+						       y1 + 1))
+					return FALSE;
+			}
+
+			x1 += sdx;
+			if (step) {
+				y1 += sdy;
+				e += e2;
+				start = x1;
+			} else {
+				e += e1;
+			}
+		}
+	} else {
+		for (start = y1; len--; ) {
+			Bool step = e >= 0;
+
+			if (step || len == 0) {
+				if (!vivante_boxes_add(vivante, b,
+						       x1, min(start, y1),
+						       x1 + 1,
+						       max(start, y1) + 1))
+					return FALSE;
+			}
+
+			y1 += sdy;
+			if (step) {
+				x1 += sdx;
+				e += e2;
+				start = y1;
+			} else {
+				e += e1;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static Bool vivante_fill_lines(struct vivante *vivante,
+	DrawablePtr pDrawable, GCPtr pGC, struct vivante_boxes *runs)
+{
+	struct vivante_pixmap *vPix;
+	struct vivante_boxes out;
+	PixmapPtr pPix;
+	RegionPtr clip;
+	int off_x, off_y;
+
+	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
+	vPix = vivante_get_pixmap_priv(pPix);
+	if (!vPix)
+		return FALSE;
+
+	clip = fbGetCompositeClip(pGC);
+	if (!vivante_boxes_init(vivante, &out, runs->n) ||
+	    !vivante_clip_boxes(vivante, clip, runs->box, runs->n, &out))
+		return FALSE;
+
+	if (out.n == 0)
+		return TRUE;
+
+	return vivante_fill(vivante, vPix, pDrawable, pGC,
+			    RegionExtents(clip), out.box, out.n,
+			    off_x, off_y);
+}
+
+Bool vivante_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	unsigned bias = miGetZeroLineBias(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	struct vivante_boxes runs;
+	int i, x0, y0, x1, y1, x2, y2;
+	Bool last;
+
+	/* fb draws nothing for a single point */
+	if (npt < 2)
+		return TRUE;
+
+	if (!vivante_boxes_init(vivante, &runs, npt))
+		return FALSE;
+
+	x0 = x1 = x2 = ppt[0].x + pDrawable->x;
+	y0 = y1 = y2 = ppt[0].y + pDrawable->y;
+
+	for (i = 1; i < npt; i++) {
+		x1 = x2;
+		y1 = y2;
+
+		if (mode == CoordModePrevious) {
+			x2 += ppt[i].x;
+			y2 += ppt[i].y;
+		} else {
+			x2 = ppt[i].x + pDrawable->x;
+			y2 = ppt[i].y + pDrawable->y;
+		}
+
+		/* Joins are drawn once, as the first point of each line */
+		if (!vivante_line_runs(vivante, &runs, bias, x1, y1, x2, y2,
+				       FALSE))
+			return FALSE;
+	}
+
+	/*
+	 * Draw the final point as fb does, unless the cap style says not
+	 * to.  fb has two zero-width line paths which differ here.  The
+	 * solid single-clip-box path (fbPolyline8/16/32) skips the point
+	 * when the lines end where they started, as it has been drawn,
+	 * except when the last line crosses the clip box: that line goes
+	 * through fbSegment, which draws its last point.  fbZeroLine, used
+	 * for every other GC, always draws it.
+	 */
+	last = pGC->capStyle != CapNotLast;
+	if (last && pGC->fillStyle == FillSolid &&
+	    RegionNumRects(clip) == 1) {
+		const BoxRec *b = RegionExtents(clip);
+
+		last = x2 != x0 || y2 != y0 ||
+		       x1 < b->x1 || x1 >= b->x2 || y1 < b->y1 || y1 >= b->y2 ||
+		       x2 < b->x1 || x2 >= b->x2 || y2 < b->y1 || y2 >= b->y2;
+	}
+
+	if (last && !vivante_boxes_add(vivante, &runs, x2, y2, x2 + 1, y2 + 1))
+		return FALSE;
+
+	return vivante_fill_lines(vivante, pDrawable, pGC, &runs);
+}
+
+Bool vivante_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	unsigned bias = miGetZeroLineBias(pDrawable->pScreen);
+	struct vivante_boxes runs;
+	Bool draw_last = pGC->capStyle != CapNotLast;
+	int i;
+
+	if (!vivante_boxes_init(vivante, &runs, nseg))
+		return FALSE;
+
+	for (i = 0; i < nseg; i++, pSeg++)
+		if (!vivante_line_runs(vivante, &runs, bias,
+				       pSeg->x1 + pDrawable->x,
+				       pSeg->y1 + pDrawable->y,
+				       pSeg->x2 + pDrawable->x,
+				       pSeg->y2 + pDrawable->y, draw_last))
+			return FALSE;
+
+	return vivante_fill_lines(vivante, pDrawable, pGC, &runs);
+}
+
+/*
+ * Core font glyphs are kept in a 32bpp atlas pixmap, one glyph bit per
+ * pixel, with set bits all ones and clear bits zero.  Text is drawn by
+ * blitting from the atlas with a ROP which selects the brush (the
+ * foreground colour, combined with the destination by the GC function)
+ * where the source is set, and leaves the destination alone where it
+ * is clear.  Glyphs are written to the atlas by the CPU the first time
+ * they are seen, and the atlas is reset when it fills.
+ */
+static struct vivante_glyph_entry *vivante_glyph_lookup(
+	struct vivante_glyph_atlas *atlas, FontPtr font, CharInfoPtr pci)
+{
+	uintptr_t key = (uintptr_t)pci >> 3 ^ (uintptr_t)font >> 6;
+	unsigned h = key & (VIVANTE_GLYPH_HASH_SIZE - 1);
+
+	while (atlas->hash[h].pci) {
+		if (atlas->hash[h].pci == pci && atlas->hash[h].font == font)
+			break;
+		h = (h + 1) & (VIVANTE_GLYPH_HASH_SIZE - 1);
+	}
+	return &atlas->hash[h];
+}
+
+static void vivante_glyph_atlas_reset(struct vivante_glyph_atlas *atlas)
+{
+	memset(atlas->hash, 0, sizeof(atlas->hash));
+	atlas->count = 0;
+	atlas->shelf_x = 0;
+	atlas->shelf_y = 0;
+	atlas->shelf_h = 0;
+	atlas->resets++;
+}
+
+/* Drop the atlas contents if it holds glyphs from this font */
+void vivante_glyph_atlas_flush_font(struct vivante *vivante, FontPtr font)
+{
+	struct vivante_glyph_atlas *atlas = &vivante->glyph_atlas;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_GLYPH_HASH_SIZE; i++) {
+		if (atlas->hash[i].pci && atlas->hash[i].font == font) {
+			vivante_glyph_atlas_reset(atlas);
+			break;
+		}
+	}
+}
+
+void vivante_glyph_atlas_fini(struct vivante *vivante)
+{
+	struct vivante_glyph_atlas *atlas = &vivante->glyph_atlas;
+	PixmapPtr pixmap = atlas->pixmap;
+
+	vivante_glyph_atlas_reset(atlas);
+	atlas->pixmap = NULL;
+
+	if (pixmap)
+		pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+}
+
+/* Find space for a w x h glyph in the atlas, using simple shelves */
+static Bool vivante_glyph_alloc(struct vivante_glyph_atlas *atlas,
+	int w, int h, struct vivante_glyph_entry *e)
+{
+	if (atlas->count >= VIVANTE_GLYPH_HASH_SIZE * 3 / 4)
+		return FALSE;
+
+	if (atlas->shelf_x + w > VIVANTE_GLYPH_ATLAS_SIZE) {
+		atlas->shelf_y += atlas->shelf_h;
+		atlas->shelf_x = 0;
+		atlas->shelf_h = 0;
+	}
+
+	if (atlas->shelf_y + h > VIVANTE_GLYPH_ATLAS_SIZE)
+		return FALSE;
+
+	e->x = atlas->shelf_x;
+	e->y = atlas->shelf_y;
+	atlas->shelf_x += w;
+	if (atlas->shelf_h < h)
+		atlas->shelf_h = h;
+
+	return TRUE;
+}
+
+static void vivante_glyph_write(PixmapPtr pixmap,
+	const struct vivante_glyph_entry *e, CharInfoPtr pci)
+{
+	const uint8_t *src = FONTGLYPHBITS(NULL, pci);
+	int w = GLYPHWIDTHPIXELS(pci), h = GLYPHHEIGHTPIXELS(pci);
+	int stride = GLYPHWIDTHBYTESPADDED(pci);
+	int x, y;
+
+	for (y = 0; y < h; y++, src += stride) {
+		uint32_t *dst = (uint32_t *)((char *)pixmap->devPrivate.ptr +
+					     (e->y + y) * pixmap->devKind);
+
+		dst += e->x;
+		for (x = 0; x < w; x++)
+			dst[x] = vivante_stipple_bit(src, x) ? ~0 : 0;
+	}
+}
+
+/*
+ * Load the glyphs which are not already in the atlas, mapping the atlas
+ * for the CPU on the first write.  Fails if the atlas fills up.
+ */
+static Bool vivante_glyph_load(struct vivante_glyph_atlas *atlas,
+	FontPtr font, CharInfoPtr *ppci, unsigned nglyph, Bool *mapped)
+{
+	unsigned i;
+
+	for (i = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		struct vivante_glyph_entry *e;
+		int w = GLYPHWIDTHPIXELS(pci), h = GLYPHHEIGHTPIXELS(pci);
+
+		if (w == 0 || h == 0)
+			continue;
+
+		e = vivante_glyph_lookup(atlas, font, pci);
+		if (e->pci) {
+			atlas->hits++;
+			continue;
+		}
+
+		atlas->misses++;
+
+		if (!vivante_glyph_alloc(atlas, w, h, e))
+			return FALSE;
+
+		if (!*mapped) {
+			vivante_prepare_drawable(&atlas->pixmap->drawable,
+						 ACCESS_RW);
+			*mapped = TRUE;
+		}
+
+		vivante_glyph_write(atlas->pixmap, e, pci);
+		e->font = font;
+		e->pci = pci;
+		atlas->count++;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Make sure all the glyphs are in the atlas.  If the atlas fills up,
+ * it is reset and the glyphs for this call loaded again; if they still
+ * do not fit, we fail and the caller falls back to fb.
+ */
+static Bool vivante_glyph_upload(struct vivante *vivante, ScreenPtr pScreen,
+	FontPtr font, CharInfoPtr *ppci, unsigned nglyph)
+{
+	struct vivante_glyph_atlas *atlas = &vivante->glyph_atlas;
+	Bool mapped = FALSE, ret;
+
+	if (!atlas->pixmap) {
+		PixmapPtr pixmap;
+
+		pixmap = pScreen->CreatePixmap(pScreen, VIVANTE_GLYPH_ATLAS_SIZE,
+					       VIVANTE_GLYPH_ATLAS_SIZE, 32, 0);
+		if (!pixmap)
+			return FALSE;
+
+		if (!vivante_get_pixmap_priv(pixmap)) {
+			pScreen->DestroyPixmap(pixmap);
+			return FALSE;
+		}
+
+		atlas->pixmap = pixmap;
+	}
+
+	ret = vivante_glyph_load(atlas, font, ppci, nglyph, &mapped);
+	if (!ret) {
+		/* Start again with an empty atlas */
+		vivante_glyph_atlas_reset(atlas);
+		ret = vivante_glyph_load(atlas, font, ppci, nglyph, &mapped);
+	}
+
+	if (mapped)
+		vivante_finish_drawable(&atlas->pixmap->drawable, ACCESS_RW);
+
+	return ret;
+}
+
+Bool vivante_accel_GlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned nglyph, CharInfoPtr *ppci, Bool image)
+{
+	struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
+	struct vivante_glyph_atlas *atlas = &vivante->glyph_atlas;
+	struct vivante_pixmap *vPix, *vAtlas;
+	FontPtr font = pGC->font;
+	PixmapPtr pPix;
+	RegionPtr clip;
+	const BoxRec *ext, *clip_box, *clip_end, *c;
+	gcsRECT *rects, *src, *dst, rclip;
+	gctUINT8 rop;
+	gceSTATUS err = gcvSTATUS_OK;
+	unsigned chunk, n, i;
+	int off_x, off_y, nclip;
 
 	pPix = vivante_drawable_pixmap_deltas(pDrawable, &off_x, &off_y);
 	vPix = vivante_get_pixmap_priv(pPix);
 	if (!vPix)
 		return FALSE;
 
-	clip = fbGetCompositeClip(pGC);
-	clipBox = *RegionExtents(clip);
+	if (!vivante_glyph_upload(vivante, pDrawable->pScreen, font,
+				  ppci, nglyph))
+		return FALSE;
+
+	vAtlas = vivante_get_pixmap_priv(atlas->pixmap);
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	clip = fbGetCompositeClip(pGC);
+	ext = RegionExtents(clip);
+
+	if (image) {
+		struct vivante_boxes boxes;
+		ExtentInfoRec info;
+		BoxRec box;
+
+		/* The background is a single box, filled with GXcopy */
+		QueryGlyphExtents(font, ppci, nglyph, &info);
+		box.x1 = x + min(info.overallWidth, 0);
+		box.x2 = x + max(info.overallWidth, 0);
+		box.y1 = y - FONTASCENT(font);
+		box.y2 = y + FONTDESCENT(font);
+
+		if (!vivante_boxes_init(vivante, &boxes, 1) ||
+		    !vivante_clip_boxes(vivante, clip, &box, 1, &boxes))
+			return FALSE;
+
+		if (boxes.n) {
+			err = vivante_load_solid_brush(vivante, vPix->format,
+						       pGC->bgPixel);
+			if (err != gcvSTATUS_OK) {
+				vivante_error(vivante, "gco2D_LoadSolidBrush",
+					      err);
+				return FALSE;
+			}
+
+			if (!vivante_fill_brush(vivante, vPix, ext, boxes.box,
+						boxes.n, off_x, off_y,
+						0xf0, 0xf0))
+				return FALSE;
+		}
+
+		rop = vivante_fill_rop[GXcopy];
+	} else {
+		rop = vivante_fill_rop[pGC->alu];
+	}
+
+	/* Apply the brush where the source is set, otherwise keep dest */
+	rop = (rop & 0xcc) | (0xaa & 0x33);
+
+	chunk = vivante->max_rect_count;
+	rects = vivante_scratch_alloc(&vivante->scratch,
+				      2 * chunk * sizeof *rects);
+	if (!rects)
+		return FALSE;
+
+	src = rects;
+	dst = rects + chunk;
+
+	if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target) ||
+	    !gal_prepare_gpu(vivante, vAtlas, GPU2D_Source))
+		return FALSE;
+
+	vivante_disable_alpha_blend(vivante);
+
+	err = vivante_load_solid_brush(vivante, vPix->format, pGC->fgPixel);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_LoadSolidBrush", err);
+		return FALSE;
+	}
+
+	clip_box = RegionRects(clip);
+	nclip = RegionNumRects(clip);
+	clip_end = clip_box + nclip;
+
+	for (i = n = 0; i < nglyph; i++) {
+		CharInfoPtr pci = ppci[i];
+		const struct vivante_glyph_entry *e;
+		int gx, gy, x1, y1, x2, y2;
+
+		gx = x + pci->metrics.leftSideBearing;
+		gy = y - pci->metrics.ascent;
+		x += pci->metrics.characterWidth;
+
+		x1 = max(gx, ext->x1);
+		y1 = max(gy, ext->y1);
+		x2 = min(gx + GLYPHWIDTHPIXELS(pci), ext->x2);
+		y2 = min(gy + GLYPHHEIGHTPIXELS(pci), ext->y2);
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		e = vivante_glyph_lookup(atlas, font, pci);
+
+		for (c = vivante_clip_find_band(clip_box, nclip, y1);
+		     c < clip_end && c->y1 < y2; c++) {
+			BoxRec b;
+
+			if (c->x2 <= x1)
+				continue;
+
+			if (c->x1 >= x2) {
+				while (c + 1 < clip_end && c[1].y1 == c->y1)
+					c++;
+				continue;
+			}
+
+			b.x1 = max(x1, c->x1);
+			b.y1 = max(y1, c->y1);
+			b.x2 = min(x2, c->x2);
+			b.y2 = min(y2, c->y2);
+
+			RectBox(&dst[n], &b, off_x, off_y);
+			src[n].left = e->x + b.x1 - gx;
+			src[n].top = e->y + b.y1 - gy;
+			src[n].right = src[n].left + b.x2 - b.x1;
+			src[n].bottom = src[n].top + b.y2 - b.y1;
+
+			if (n == 0) {
+				rclip = dst[0];
+			} else {
+				rclip.left = min(rclip.left, dst[n].left);
+				rclip.top = min(rclip.top, dst[n].top);
+				rclip.right = max(rclip.right, dst[n].right);
+				rclip.bottom = max(rclip.bottom, dst[n].bottom);
+			}
+
+			if (++n == chunk) {
+				err = vivante_blit_copy_rects(vivante, &rclip,
+						src, dst, n, rop, vPix->format);
+				if (err != gcvSTATUS_OK)
+					goto error;
+				n = 0;
+			}
+		}
+	}
+
+	if (n)
+		err = vivante_blit_copy_rects(vivante, &rclip, src, dst, n,
+					      rop, vPix->format);
+
+ error:
+	if (err != gcvSTATUS_OK)
+		vivante_error(vivante, "glyph BatchBlit", err);
+
+	vivante_batch_add(vivante, vAtlas, ACCESS_RO);
+	vivante_batch_add(vivante, vPix, ACCESS_RW);
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
+/*
+ * Fill the boxes with the tile in the current source, which is tile_w x
+ * tile_h and aligned to off_x, off_y.  As with vivante_blit_copy(), the
+ * rectangles are gathered and submitted max_rect_count at a time.
+ */
+static gceSTATUS vivante_tile_boxes(struct vivante *vivante,
+	const BoxRec *pBox, int nbox, int tile_w, int tile_h,
+	int off_x, int off_y, gctUINT8 rop, gceSURF_FORMAT format)
+{
+	gceSTATUS err = gcvSTATUS_OK;
+	gcsRECT *rects, *src, *dst, clip;
+	unsigned chunk, n;
+
+	chunk = vivante->max_rect_count;
+	rects = vivante_scratch_alloc(&vivante->scratch,
+				      2 * chunk * sizeof *rects);
+	if (!rects)
+		return gcvSTATUS_OUT_OF_MEMORY;
+
+	src = rects;
+	dst = rects + chunk;
+
+	for (n = 0; nbox; nbox--, pBox++) {
+		int dst_y, height, tile_y;
+
+		dst_y = pBox->y1;
+		height = pBox->y2 - dst_y;
+		modulus(dst_y - off_y, tile_h, tile_y);
+
+		while (height > 0) {
+			int dst_x, width, tile_x, h;
+
+			dst_x = pBox->x1;
+			width = pBox->x2 - dst_x;
+			modulus(dst_x - off_x, tile_w, tile_x);
+
+			h = tile_h - tile_y;
+			if (h > height)
+				h = height;
+			height -= h;
+
+			while (width > 0) {
+				int w;
+
+				w = tile_w - tile_x;
+				if (w > width)
+					w = width;
+				width -= w;
+
+				src[n].left = tile_x;
+				src[n].top = tile_y;
+				src[n].right = tile_x + w;
+				src[n].bottom = tile_y + h;
+				dst[n].left = dst_x;
+				dst[n].top = dst_y;
+				dst[n].right = dst_x + w;
+				dst[n].bottom = dst_y + h;
+
+				if (n == 0) {
+					clip = dst[0];
+				} else {
+					clip.left = min(clip.left, dst[n].left);
+					clip.top = min(clip.top, dst[n].top);
+					clip.right = max(clip.right, dst[n].right);
+					clip.bottom = max(clip.bottom, dst[n].bottom);
+				}
+
+				if (++n == chunk) {
+					err = vivante_blit_copy_rects(vivante,
+							&clip, src, dst, n,
+							rop, format);
+					if (err != gcvSTATUS_OK)
+						return err;
+					n = 0;
+				}
+
+				dst_x += w;
+				tile_x = 0;
+			}
+			dst_y += h;
+			tile_y = 0;
+		}
+	}
+
+	if (n)
+		err = vivante_blit_copy_rects(vivante, &clip, src, dst, n,
+					      rop, format);
+
+	return err;
+}
+
+void vivante_tile_cache_invalidate(struct vivante *vivante,
+	struct vivante_pixmap *vPix)
+{
+	struct vivante_tile_cache *cache = &vivante->tile_cache;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_TILE_CACHE_ENTRIES; i++)
+		if (cache->entry[i].tile == vPix)
+			cache->entry[i].tile = NULL;
+
+	vPix->tile_cached = FALSE;
+}
+
+void vivante_tile_cache_fini(struct vivante *vivante)
+{
+	struct vivante_tile_cache *cache = &vivante->tile_cache;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_TILE_CACHE_ENTRIES; i++) {
+		PixmapPtr pixmap = cache->entry[i].pixmap;
+
+		if (cache->entry[i].tile)
+			cache->entry[i].tile->tile_cached = FALSE;
+		cache->entry[i].tile = NULL;
+		cache->entry[i].pixmap = NULL;
+
+		if (pixmap)
+			pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+	}
+}
+
+/*
+ * Look up, or create, a pre-expanded copy of a small tile.  Entries are
+ * invalidated whenever the tile is written, and the expanded pixmap of
+ * a stale entry is reused if it is the right size.  Returns the pixmap
+ * to use as the tile source, updating tile_w and tile_h, or NULL if the
+ * tile should be used as is.
+ */
+static struct vivante_pixmap *vivante_tile_cache_lookup(
+	struct vivante *vivante, PixmapPtr pTile, struct vivante_pixmap *vTile,
+	int *tile_w, int *tile_h)
+{
+	struct vivante_tile_cache *cache = &vivante->tile_cache;
+	struct vivante_pixmap *vExp;
+	PixmapPtr pExp;
+	BoxRec box;
+	int w = *tile_w, h = *tile_h;
+	unsigned i, slot;
+	gceSTATUS err;
+
+	if (w >= VIVANTE_TILE_CACHE_SIZE / 2 &&
+	    h >= VIVANTE_TILE_CACHE_SIZE / 2)
+		return NULL;
+
+	w *= (VIVANTE_TILE_CACHE_SIZE + w - 1) / w;
+	h *= (VIVANTE_TILE_CACHE_SIZE + h - 1) / h;
+
+	for (i = 0; i < VIVANTE_TILE_CACHE_ENTRIES; i++) {
+		if (cache->entry[i].tile == vTile) {
+			pExp = cache->entry[i].pixmap;
+			cache->hits++;
+			*tile_w = pExp->drawable.width;
+			*tile_h = pExp->drawable.height;
+			return vivante_get_pixmap_priv(pExp);
+		}
+	}
+
+	cache->misses++;
+
+	/* Prefer a stale entry whose pixmap can be reused */
+	slot = VIVANTE_TILE_CACHE_ENTRIES;
+	for (i = 0; i < VIVANTE_TILE_CACHE_ENTRIES; i++) {
+		pExp = cache->entry[i].pixmap;
+		if (!cache->entry[i].tile && pExp &&
+		    pExp->drawable.width == w && pExp->drawable.height == h &&
+		    pExp->drawable.depth == pTile->drawable.depth) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot == VIVANTE_TILE_CACHE_ENTRIES) {
+		slot = cache->next;
+		cache->next = (slot + 1) % VIVANTE_TILE_CACHE_ENTRIES;
+
+		if (cache->entry[slot].tile)
+			vivante_tile_cache_invalidate(vivante,
+						      cache->entry[slot].tile);
+
+		pExp = cache->entry[slot].pixmap;
+		if (pExp) {
+			cache->entry[slot].pixmap = NULL;
+			pExp->drawable.pScreen->DestroyPixmap(pExp);
+		}
+
+		pExp = pTile->drawable.pScreen->CreatePixmap(
+				pTile->drawable.pScreen, w, h,
+				pTile->drawable.depth, 0);
+		if (!pExp)
+			return NULL;
+
+		if (!vivante_get_pixmap_priv(pExp)) {
+			pExp->drawable.pScreen->DestroyPixmap(pExp);
+			return NULL;
+		}
+
+		cache->entry[slot].pixmap = pExp;
+	}
 
-	nb = 0;
-	while (n--) {
-		BoxRec full_rect;
+	pExp = cache->entry[slot].pixmap;
+	vExp = vivante_get_pixmap_priv(pExp);
 
-		full_rect.x1 = prect->x + pDrawable->x;
-		full_rect.y1 = prect->y + pDrawable->y;
-		full_rect.x2 = full_rect.x1 + prect->width;
-		full_rect.y2 = full_rect.y1 + prect->height;
+	if (!gal_prepare_gpu(vivante, vExp, GPU2D_Target) ||
+	    !gal_prepare_gpu(vivante, vTile, GPU2D_Source))
+		return NULL;
 
-		prect++;
+	vivante_disable_alpha_blend(vivante);
 
-		for (box = RegionRects(clip), nclip = RegionNumRects(clip);
-		     nclip; nclip--, box++) {
-			if (BoxClip(&boxes[nb], &full_rect, box))
-				continue;
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = w;
+	box.y2 = h;
 
-			if (++nb > 254) {
-				ret = vivante_fill(vivante, vPix, pGC, &clipBox,
-						   boxes, nb, off_x, off_y);
-				nb = 0;
-				if (!ret)
-					break;
-			}
-		}
-		if (!ret)
-			break;
+	err = vivante_tile_boxes(vivante, &box, 1, *tile_w, *tile_h, 0, 0,
+				 vivante_copy_rop[GXcopy], vExp->format);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "tile expansion", err);
+		return NULL;
 	}
-	if (nb)
-		ret = vivante_fill(vivante, vPix, pGC, &clipBox,
-				   boxes, nb, off_x, off_y);
 
-	return ret;
+	vivante_batch_add(vivante, vTile, ACCESS_RO);
+	vivante_batch_add(vivante, vExp, ACCESS_RW);
+
+	cache->entry[slot].tile = vTile;
+	vTile->tile_cached = TRUE;
+
+	*tile_w = w;
+	*tile_h = h;
+
+	return vExp;
 }
 
 Bool vivante_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
@@ -921,23 +3430,36 @@ Bool vivante_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 
 	nbox = RegionNumRects(rects);
 	if (nbox) {
+		struct vivante_pixmap *vSrc;
 		int tile_w, tile_h;
-		BoxPtr pBox;
-		gceSTATUS err = gcvSTATUS_OK;
+		gctUINT8 rop = vivante_copy_rop[pGC ? pGC->alu : GXcopy];
+		gceSTATUS err;
 
 		/* Translate them for the drawable offset */
 		RegionTranslate(rects, off_x, off_y);
 
 		ret = FALSE;
 
+		tile_w = pTile->drawable.width;
+		tile_h = pTile->drawable.height;
+
+		/* Use a pre-expanded copy of small tiles if we can */
+		vSrc = vivante_tile_cache_lookup(vivante, pTile, vTile,
+						 &tile_w, &tile_h);
+		if (!vSrc) {
+			vSrc = vTile;
+			tile_w = pTile->drawable.width;
+			tile_h = pTile->drawable.height;
+		}
+
 		/* Right, we're all good to go */
 		if (!gal_prepare_gpu(vivante, vPix, GPU2D_Target) ||
-		    !gal_prepare_gpu(vivante, vTile, GPU2D_Source))
+		    !gal_prepare_gpu(vivante, vSrc, GPU2D_Source))
 			goto fallback;
 
 		vivante_disable_alpha_blend(vivante);
 
-		err = gco2D_LoadSolidBrush(vivante->e2d, vPix->format, 0, 0, ~0ULL);
+		err = vivante_load_solid_brush(vivante, vPix->format, 0);
 		if (err != gcvSTATUS_OK) {
 			vivante_error(vivante, "LoadSolidBrush", err);
 			goto fallback;
@@ -947,77 +3469,16 @@ Bool vivante_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 		off_x += pDrawable->x + pGC->patOrg.x;
 		off_y += pDrawable->y + pGC->patOrg.y;
 
-		tile_w = pTile->drawable.width;
-		tile_h = pTile->drawable.height;
-
-		pBox = RegionRects(rects);
-		while (nbox--) {
-			int dst_y, height, tile_y;
-			gcsRECT clip;
-			gctUINT8 rop = vivante_copy_rop[pGC ? pGC->alu : GXcopy];
-
-			RectBox(&clip, pBox, 0, 0);
-
-			err = gco2D_SetClipping(vivante->e2d, &clip);
-			if (err != gcvSTATUS_OK) {
-				vivante_error(vivante, "SetClipping", err);
-				break;
-			}
+		err = vivante_tile_boxes(vivante, RegionRects(rects), nbox,
+					 tile_w, tile_h, off_x, off_y,
+					 rop, vPix->format);
+		if (err != gcvSTATUS_OK)
+			vivante_error(vivante, "BatchBlit", err);
 
-			dst_y = pBox->y1;
-			height = pBox->y2 - dst_y;
-			modulus(dst_y - off_y, tile_h, tile_y);
-
-			while (height > 0) {
-				int dst_x, width, tile_x, h;
-
-				dst_x = pBox->x1;
-				width = pBox->x2 - dst_x;
-				modulus(dst_x - off_x, tile_w, tile_x);
-
-				h = tile_h - tile_y;
-				if (h > height)
-					h = height;
-				height -= h;
-
-				while (width > 0) {
-					gcsRECT dst, src;
-					int w;
-
-					w = tile_w - tile_x;
-					if (w > width)
-						w = width;
-					width -= w;
-
-					src.left = tile_x;
-					src.top = tile_y;
-					src.right = tile_x + w;
-					src.bottom = tile_y + h;
-					dst.left = dst_x;
-					dst.top = dst_y;
-					dst.right = dst_x + w;
-					dst.bottom = dst_y + h;
-
-					err = gco2D_BatchBlit(vivante->e2d, 1, &src, &dst, rop, rop, vPix->format);
-					if (err)
-						break;
-
-					dst_x += w;
-					tile_x = 0;
-				}
-				if (err)
-					break;
-				dst_y += h;
-				tile_y = 0;
-			}
-			if (err)
-				break;
-			pBox++;
-		}
-		vivante_batch_add(vivante, vTile);
-		vivante_batch_add(vivante, vPix);
-		vivante_flush(vivante);
-		ret = err == 0 ? TRUE : FALSE;
+		vivante_batch_add(vivante, vSrc, ACCESS_RO);
+		vivante_batch_add(vivante, vPix, ACCESS_RW);
+		vivante_submit(vivante);
+		ret = err == gcvSTATUS_OK ? TRUE : FALSE;
 	} else {
 		ret = TRUE;
 	}
@@ -1029,6 +3490,31 @@ Bool vivante_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	return ret;
 }
 
+/*
+ * Release the idle temporary surfaces which were last used before
+ * 'expire'.  Their bos go back to the bo cache.
+ */
+void vivante_temp_pool_trim(struct vivante *vivante, CARD32 expire)
+{
+	struct vivante_temp_pool *pool = &vivante->temp_pool;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_TEMP_POOL_ENTRIES; i++) {
+		PixmapPtr pixmap = pool->entry[i].pixmap;
+
+		if (pixmap && !pool->entry[i].busy &&
+		    (int32_t)(pool->entry[i].time - expire) < 0) {
+			pool->entry[i].pixmap = NULL;
+			pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+		}
+	}
+}
+
+void vivante_temp_pool_fini(struct vivante *vivante)
+{
+	vivante_temp_pool_trim(vivante, GetTimeInMillis() + 1);
+}
+
 #ifdef RENDER
 #include "mipict.h"
 #include "fbpict.h"
@@ -1058,6 +3544,44 @@ static Bool transform_is_integer_translation(PictTransformPtr t, int *tx, int *t
 	return TRUE;
 }
 
+/* A transform which only scales (by positive factors) and translates */
+static Bool transform_is_scale(PictTransformPtr t)
+{
+	return t &&
+	       t->matrix[0][0] > 0 &&
+	       t->matrix[0][1] == 0 &&
+	       t->matrix[1][0] == 0 &&
+	       t->matrix[1][1] > 0 &&
+	       t->matrix[2][0] == 0 &&
+	       t->matrix[2][1] == 0 &&
+	       t->matrix[2][2] == IntToxFixed(1);
+}
+
+/*
+ * Map the edge at v along one axis of a scaling transform to the source.
+ * The 2D engine can only start and end the source on whole pixels, so
+ * reject edges which do not land within VIVANTE_SCALE_EDGE_TOLERANCE
+ * of one; that allows for the error of factors such as 1/3 which are
+ * not exact in 16.16 fixed point, while staying well below the 1/2
+ * pixel at which nearest sampling would pick a different pixel.
+ */
+#define VIVANTE_SCALE_EDGE_TOLERANCE	(IntToxFixed(1) / 256)
+
+static Bool transform_scale_edge(PictTransformPtr t, int axis, int v,
+	int *edge)
+{
+	int64_t e, r;
+
+	e = (int64_t)v * t->matrix[axis][axis] + t->matrix[axis][2];
+	r = (e + IntToxFixed(1) / 2) & ~(int64_t)(IntToxFixed(1) - 1);
+	if (e - r > VIVANTE_SCALE_EDGE_TOLERANCE ||
+	    r - e > VIVANTE_SCALE_EDGE_TOLERANCE)
+		return FALSE;
+
+	*edge = r >> 16;
+	return TRUE;
+}
+
 static Bool drawable_contains(DrawablePtr drawable, int x, int y, int w, int h)
 {
 	if (x < 0 || y < 0 || x + w > drawable->width || y + h > drawable->height)
@@ -1081,15 +3605,6 @@ static void adjust_repeat(PicturePtr pPict, int x, int y, unsigned w, unsigned h
 	}
 }
 
-struct vivante_blend_op {
-	gceSURF_BLEND_FACTOR_MODE src_blend;
-	gceSURF_BLEND_FACTOR_MODE dst_blend;
-	gceSURF_GLOBAL_ALPHA_MODE src_global_alpha;
-	gceSURF_GLOBAL_ALPHA_MODE dst_global_alpha;
-	uint8_t src_alpha;
-	uint8_t dst_alpha;
-};
-
 static const struct vivante_blend_op vivante_composite_op[] = {
 #define OP(op,s,d) \
 	[PictOp##op] = { \
@@ -1115,6 +3630,356 @@ static const struct vivante_blend_op vivante_composite_op[] = {
 #undef OP
 };
 
+static unsigned vivante_temp_pool_size(unsigned size)
+{
+	unsigned s = VIVANTE_TEMP_POOL_MIN;
+
+	while (s < size)
+		s <<= 1;
+
+	return s;
+}
+
+/*
+ * Get an ARGB temporary surface of at least w x h.  Sizes are rounded
+ * up to powers of two so that a pooled surface can serve a range of
+ * requests; the smallest idle surface which fits is used.  On a miss,
+ * the least recently used idle entry is replaced.  Temporaries larger
+ * than the pool maximum are created for the caller alone.
+ */
+static PixmapPtr vivante_temp_pool_get(struct vivante *vivante,
+	ScreenPtr pScreen, unsigned w, unsigned h)
+{
+	struct vivante_temp_pool *pool = &vivante->temp_pool;
+	PixmapPtr pixmap;
+	unsigned i, slot, best_area = ~0U;
+
+	if (w > VIVANTE_TEMP_POOL_MAX || h > VIVANTE_TEMP_POOL_MAX) {
+		pool->misses++;
+		goto uncached;
+	}
+
+	slot = VIVANTE_TEMP_POOL_ENTRIES;
+	for (i = 0; i < VIVANTE_TEMP_POOL_ENTRIES; i++) {
+		unsigned area;
+
+		pixmap = pool->entry[i].pixmap;
+		if (!pixmap || pool->entry[i].busy ||
+		    pixmap->drawable.width < w || pixmap->drawable.height < h)
+			continue;
+
+		area = pixmap->drawable.width * pixmap->drawable.height;
+		if (area < best_area) {
+			best_area = area;
+			slot = i;
+		}
+	}
+
+	if (slot != VIVANTE_TEMP_POOL_ENTRIES) {
+		pool->hits++;
+		pool->entry[slot].busy = TRUE;
+		return pool->entry[slot].pixmap;
+	}
+
+	pool->misses++;
+
+	/* Prefer an empty entry, otherwise the oldest idle one */
+	for (i = 0; i < VIVANTE_TEMP_POOL_ENTRIES; i++) {
+		if (pool->entry[i].busy)
+			continue;
+		if (!pool->entry[i].pixmap) {
+			slot = i;
+			break;
+		}
+		if (slot == VIVANTE_TEMP_POOL_ENTRIES ||
+		    (int32_t)(pool->entry[i].time - pool->entry[slot].time) < 0)
+			slot = i;
+	}
+
+	if (slot == VIVANTE_TEMP_POOL_ENTRIES)
+		goto uncached;
+
+	pixmap = pool->entry[slot].pixmap;
+	if (pixmap) {
+		pool->entry[slot].pixmap = NULL;
+		pScreen->DestroyPixmap(pixmap);
+	}
+
+	pixmap = pScreen->CreatePixmap(pScreen, vivante_temp_pool_size(w),
+				       vivante_temp_pool_size(h), 32, 0);
+	if (!pixmap)
+		return NULL;
+
+	if (!vivante_get_pixmap_priv(pixmap)) {
+		pScreen->DestroyPixmap(pixmap);
+		return NULL;
+	}
+
+	pool->entry[slot].pixmap = pixmap;
+	pool->entry[slot].busy = TRUE;
+
+	return pixmap;
+
+ uncached:
+	pixmap = pScreen->CreatePixmap(pScreen, w, h, 32, 0);
+	if (pixmap && !vivante_get_pixmap_priv(pixmap)) {
+		pScreen->DestroyPixmap(pixmap);
+		pixmap = NULL;
+	}
+
+	return pixmap;
+}
+
+static void vivante_temp_pool_put(struct vivante *vivante, PixmapPtr pixmap)
+{
+	struct vivante_temp_pool *pool = &vivante->temp_pool;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_TEMP_POOL_ENTRIES; i++) {
+		if (pool->entry[i].pixmap == pixmap) {
+			pool->entry[i].busy = FALSE;
+			pool->entry[i].time = GetTimeInMillis();
+			return;
+		}
+	}
+
+	pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+}
+
+/*
+ * Get the temporary surface for a Composite operation, creating it on
+ * first use.  Its contents are undefined.
+ */
+static struct vivante_pixmap *vivante_composite_temp(struct vivante *vivante,
+	ScreenPtr pScreen, PixmapPtr *ppTemp, unsigned w, unsigned h)
+{
+	struct vivante_pixmap *vTemp;
+
+	if (!*ppTemp) {
+		*ppTemp = vivante_temp_pool_get(vivante, pScreen, w, h);
+		if (!*ppTemp)
+			return NULL;
+	}
+
+	vTemp = vivante_get_pixmap_priv(*ppTemp);
+	vTemp->pict_format = vivante_pict_format(PICT_a8r8g8b8, FALSE);
+
+	return vTemp;
+}
+
+/*
+ * Expand a RepeatNormal picture into a temporary on the GPU, tiling it
+ * over the clip box with the same box walking as tiled fills, and
+ * using the tile cache for small pictures.  Temporary pixel 0,0 takes
+ * picture pixel x,y (after any translation).  Pictures without alpha
+ * are made opaque by OR-ing in an opaque brush while tiling.
+ */
+static Bool vivante_tile_picture(struct vivante *vivante,
+	struct vivante_pixmap *vTemp, gcsRECT_PTR clip, PicturePtr pict,
+	int x, int y)
+{
+	struct vivante_pixmap *vTile, *vSrc;
+	gceSURF_FORMAT format;
+	PixmapPtr pTile;
+	BoxRec box;
+	gctUINT8 rop;
+	gceSTATUS err;
+	int tile_w, tile_h;
+
+	if (pict->repeat != RepeatNormal || !pict->pDrawable ||
+	    pict->pDrawable->type != DRAWABLE_PIXMAP)
+		return FALSE;
+
+	pTile = (PixmapPtr)pict->pDrawable;
+	vTile = vivante_get_pixmap_priv(pTile);
+	if (!vTile)
+		return FALSE;
+
+	format = vivante_pict_format(pict->format, FALSE);
+	if (!vivante_format_valid(vivante, format))
+		return FALSE;
+
+	tile_w = pTile->drawable.width;
+	tile_h = pTile->drawable.height;
+
+	/* Use a pre-expanded copy of small tiles if we can */
+	vSrc = vivante_tile_cache_lookup(vivante, pTile, vTile,
+					 &tile_w, &tile_h);
+	if (!vSrc) {
+		vSrc = vTile;
+		tile_w = pTile->drawable.width;
+		tile_h = pTile->drawable.height;
+	}
+
+	if (!gal_prepare_gpu(vivante, vTemp, GPU2D_Target) ||
+	    !gal_prepare_gpu(vivante, vSrc, GPU2D_SourceBlend))
+		return FALSE;
+
+	err = vivante_set_source(vivante, vSrc->handle, vSrc->pitch, format,
+				 vSrc->width, vSrc->height);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetColorSourceAdvanced", err);
+		return FALSE;
+	}
+
+	vivante_disable_alpha_blend(vivante);
+
+	if (PICT_FORMAT_A(pict->format)) {
+		rop = 0xcc;
+		err = vivante_load_solid_brush(vivante, vTemp->pict_format, 0);
+	} else {
+		rop = 0xfc;
+		err = vivante_load_solid_brush(vivante, vTemp->pict_format,
+					       0xff000000);
+	}
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_LoadSolidBrush", err);
+		return FALSE;
+	}
+
+	box.x1 = clip->left;
+	box.y1 = clip->top;
+	box.x2 = clip->right;
+	box.y2 = clip->bottom;
+
+	err = vivante_tile_boxes(vivante, &box, 1, tile_w, tile_h, -x, -y,
+				 rop, vTemp->pict_format);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "tile expansion", err);
+		return FALSE;
+	}
+
+	vivante_batch_add(vivante, vSrc, ACCESS_RO);
+	vivante_batch_add(vivante, vTemp, ACCESS_RW);
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
+/*
+ * Render a non-repeating picture with a scaling transform into a
+ * temporary on the GPU.  Temporary pixel 0,0 takes picture pixel x,y
+ * before the transform, so the temporary w x h maps to a rectangle of
+ * the source, which must lie within the drawable as we have no way to
+ * sample transparency outside it, and whose edges must be whole source
+ * pixels.  Only nearest filtering is handled, with the stretch blitter;
+ * other filters are left to pixman.  Sources without alpha are made
+ * opaque, as for tiling.
+ */
+static Bool vivante_scale_picture(struct vivante *vivante,
+	struct vivante_pixmap *vTemp, gcsRECT_PTR clip, PicturePtr pict,
+	int x, int y, int w, int h)
+{
+	PictTransformPtr t = pict->transform;
+	DrawablePtr drawable = pict->pDrawable;
+	struct vivante_pixmap *vSrc;
+	gceSURF_FORMAT format;
+	PixmapPtr pPixmap;
+	gcsRECT src, dst;
+	gceSTATUS err;
+	gctUINT8 rop;
+	Bool opaque;
+	int ox, oy;
+
+	if (!drawable || pict->repeat != RepeatNone ||
+	    !transform_is_scale(t))
+		return FALSE;
+
+	switch (pict->filter) {
+	case PictFilterNearest:
+	case PictFilterFast:
+		break;
+	default:
+		return FALSE;
+	}
+
+	pPixmap = vivante_drawable_pixmap_deltas(drawable, &ox, &oy);
+	vSrc = vivante_get_pixmap_priv(pPixmap);
+	if (!vSrc)
+		return FALSE;
+
+	format = vivante_pict_format(pict->format, FALSE);
+	if (!vivante_format_valid(vivante, format))
+		return FALSE;
+
+	/* The source rectangle covered by the temporary */
+	if (!transform_scale_edge(t, 0, x, &src.left) ||
+	    !transform_scale_edge(t, 1, y, &src.top) ||
+	    !transform_scale_edge(t, 0, x + w, &src.right) ||
+	    !transform_scale_edge(t, 1, y + h, &src.bottom))
+		return FALSE;
+
+	if (src.right <= src.left || src.bottom <= src.top ||
+	    !drawable_contains(drawable, src.left, src.top,
+			       src.right - src.left, src.bottom - src.top))
+		return FALSE;
+
+	src.left += ox + drawable->x;
+	src.top += oy + drawable->y;
+	src.right += ox + drawable->x;
+	src.bottom += oy + drawable->y;
+
+	dst.left = 0;
+	dst.top = 0;
+	dst.right = w;
+	dst.bottom = h;
+
+	opaque = !PICT_FORMAT_A(pict->format);
+	rop = opaque ? 0xfc : 0xcc;
+
+	if (!gal_prepare_gpu(vivante, vTemp, GPU2D_Target) ||
+	    !gal_prepare_gpu(vivante, vSrc, GPU2D_SourceBlend))
+		return FALSE;
+
+	vivante_disable_alpha_blend(vivante);
+
+	err = vivante_set_source(vivante, vSrc->handle, vSrc->pitch,
+				 format, vSrc->width, vSrc->height);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetColorSourceAdvanced", err);
+		return FALSE;
+	}
+
+	err = vivante_load_solid_brush(vivante, vTemp->pict_format,
+				       opaque ? 0xff000000 : 0);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_LoadSolidBrush", err);
+		return FALSE;
+	}
+
+	err = vivante_set_clipping(vivante, clip);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetClipping", err);
+		return FALSE;
+	}
+
+	err = gco2D_SetSource(vivante->e2d, &src);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetSource", err);
+		return FALSE;
+	}
+
+	err = gco2D_SetStretchRectFactors(vivante->e2d, &src, &dst);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_SetStretchRectFactors", err);
+		return FALSE;
+	}
+
+	err = gco2D_StretchBlit(vivante->e2d, 1, &dst, rop, rop,
+				vTemp->pict_format);
+	if (err != gcvSTATUS_OK) {
+		vivante_error(vivante, "gco2D_StretchBlit", err);
+		return FALSE;
+	}
+
+	vivante_queued(vivante, &dst, 1);
+	vivante_batch_add(vivante, vSrc, ACCESS_RO);
+	vivante_batch_add(vivante, vTemp, ACCESS_RW);
+	vivante_submit(vivante);
+
+	return TRUE;
+}
+
 static Bool vivante_fill_single(struct vivante *vivante,
 	struct vivante_pixmap *vPix, gcsRECT_PTR rect, uint32_t colour)
 {
@@ -1125,13 +3990,13 @@ static Bool vivante_fill_single(struct vivante *vivante,
 
 	vivante_disable_alpha_blend(vivante);
 
-	err = gco2D_LoadSolidBrush(vivante->e2d, vPix->pict_format, 0, colour, ~0ULL);
+	err = vivante_load_solid_brush(vivante, vPix->pict_format, colour);
 	if (err != gcvSTATUS_OK) {
 		vivante_error(vivante, "gco2D_LoadSolidBrush", err);
 		return FALSE;
 	}
 
-	err = gco2D_SetClipping(vivante->e2d, rect);
+	err = vivante_set_clipping(vivante, rect);
 	if (err != gcvSTATUS_OK) {
 		vivante_error(vivante, "gco2D_SetClipping", err);
 		return FALSE;
@@ -1143,7 +4008,9 @@ static Bool vivante_fill_single(struct vivante *vivante,
 		return FALSE;
 	}
 
-	vivante_batch_add(vivante, vPix);
+	vivante_queued(vivante, rect, 1);
+
+	vivante_batch_add(vivante, vPix, ACCESS_RW);
 
 	return TRUE;
 }
@@ -1163,33 +4030,21 @@ static Bool vivante_blend(struct vivante *vivante, gcsRECT_PTR clip,
 	if (!blend) {
 		vivante_disable_alpha_blend(vivante);
 	} else {
-		err = gco2D_EnableAlphaBlend(vivante->e2d,
-			blend->src_alpha,
-			blend->dst_alpha,
-			gcvSURF_PIXEL_ALPHA_STRAIGHT,
-			gcvSURF_PIXEL_ALPHA_STRAIGHT,
-			blend->src_global_alpha,
-			blend->dst_global_alpha,
-			blend->src_blend,
-			blend->dst_blend,
-			gcvSURF_COLOR_STRAIGHT,
-			gcvSURF_COLOR_STRAIGHT);
+		err = vivante_enable_alpha_blend(vivante, blend);
 		if (err != gcvSTATUS_OK) {
 			vivante_error(vivante, "gco2D_EnableAlphaBlend", err);
 			return FALSE;
 		}
-		vivante->alpha_blend_enabled = TRUE;
 	}
 
-	err = gco2D_SetColorSourceAdvanced(vivante->e2d, vSrc->handle,
-			  vSrc->pitch, vSrc->pict_format, gcvSURF_0_DEGREE,
-			  vSrc->width, vSrc->height, gcvFALSE);
+	err = vivante_set_source(vivante, vSrc->handle, vSrc->pitch,
+				 vSrc->pict_format, vSrc->width, vSrc->height);
 	if (err != gcvSTATUS_OK) {
 		vivante_error(vivante, "gco2D_SetColorSourceAdvanced", err);
 		return FALSE;
 	}
 
-	err = gco2D_SetClipping(vivante->e2d, clip);
+	err = vivante_set_clipping(vivante, clip);
 	if (err != gcvSTATUS_OK) {
 		vivante_error(vivante, "gco2D_SetClipping", err);
 		return FALSE;
@@ -1202,9 +4057,10 @@ static Bool vivante_blend(struct vivante *vivante, gcsRECT_PTR clip,
 		return FALSE;
 	}
 
-	vivante_batch_add(vivante, vDst);
-	vivante_batch_add(vivante, vSrc);
-	vivante_flush(vivante);
+	vivante_queued(vivante, rDst, nRect);
+	vivante_batch_add(vivante, vDst, ACCESS_RW);
+	vivante_batch_add(vivante, vSrc, ACCESS_RO);
+	vivante_submit(vivante);
 
 	return TRUE;
 }
@@ -1298,15 +4154,15 @@ static Bool vivante_pict_solid_argb(PicturePtr pict, uint32_t *col)
  *  If we're filling a solid
  * surface, force it to have alpha; it may be used in combination
  * with a mask.  Otherwise, we ask for the plain source format,
- * with or without alpha, and convert later when copying.
+ * with or without alpha, and convert later when copying.  The
+ * temporary surface in *ppTemp is only created if it is needed.
  */
 static struct vivante_pixmap *vivante_acquire_src(struct vivante *vivante,
-	PicturePtr pict, int x, int y, int w, int h, gcsRECT_PTR clip,
-	PixmapPtr pix, struct vivante_pixmap *vTemp,
-	INT16 *xout, INT16 *yout)
+	ScreenPtr pScreen, PicturePtr pict, int x, int y, int w, int h,
+	gcsRECT_PTR clip, PixmapPtr *ppTemp, INT16 *xout, INT16 *yout)
 {
 	PixmapPtr pPixmap;
-	struct vivante_pixmap *vSrc;
+	struct vivante_pixmap *vSrc, *vTemp;
 	DrawablePtr drawable = pict->pDrawable;
 	uint32_t colour;
 	int tx, ty, ox, oy;
@@ -1314,9 +4170,11 @@ static struct vivante_pixmap *vivante_acquire_src(struct vivante *vivante,
 	if (vivante_pict_solid_argb(pict, &colour)) {
 		*xout = 0;
 		*yout = 0;
-		if (!vivante_fill_single(vivante, vTemp, clip, colour))
+		vTemp = vivante_composite_temp(vivante, pScreen, ppTemp, w, h);
+		if (!vTemp ||
+		    !vivante_fill_single(vivante, vTemp, clip, colour))
 			return NULL;
-		vivante_flush(vivante);
+		vivante_submit(vivante);
 
 		return vTemp;
 	}
@@ -1337,19 +4195,39 @@ static struct vivante_pixmap *vivante_acquire_src(struct vivante *vivante,
 		PicturePtr dest;
 		int err;
 
+		vTemp = vivante_composite_temp(vivante, pScreen, ppTemp, w, h);
+		if (!vTemp)
+			return NULL;
+
+		*xout = 0;
+		*yout = 0;
+
+		/*
+		 * Repeating sources can be tiled into the temporary, and
+		 * scaled sources stretched or filtered into it.
+		 */
+		if (transform_is_integer_translation(pict->transform,
+						     &tx, &ty) &&
+		    vivante_tile_picture(vivante, vTemp, clip, pict,
+					 x + tx, y + ty))
+			return vTemp;
+
+		if (vivante_scale_picture(vivante, vTemp, clip, pict,
+					  x, y, w, h))
+			return vTemp;
+
 		f = PictureMatchFormat(drawable->pScreen, 32, PICT_a8r8g8b8);
 		if (!f)
 			return NULL;
 
-		dest = CreatePicture(0, &pix->drawable, f, 0, 0, serverClient, &err);
+		dest = CreatePicture(0, &(*ppTemp)->drawable, f, 0, 0,
+				     serverClient, &err);
 		if (!dest)
 			return NULL;
 		ValidatePicture(dest);
 
 		vivante_unaccel_Composite(PictOpSrc, pict, NULL, dest, x, y, 0, 0, 0, 0, w, h);
 		FreePicture(dest, 0);
-		*xout = 0;
-		*yout = 0;
 		vSrc = vTemp;
 	}
 
@@ -1377,7 +4255,8 @@ static int vivante_accel_final_blend(struct vivante *vivante,
 #endif
 
 	nrects = REGION_NUM_RECTS(region);
-	rects = malloc(sizeof(*rects) * nrects * 2);
+	rects = vivante_scratch_alloc(&vivante->scratch,
+				      sizeof(*rects) * nrects * 2);
 	if (!rects) {
 		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
 			   "%s: malloc failed\n", __FUNCTION__);
@@ -1398,7 +4277,7 @@ static int vivante_accel_final_blend(struct vivante *vivante,
 	rdst = rects + nrects;
 
 #if 0
-	vivante_batch_wait_commit(vivante, vSrc);
+	vivante_batch_wait_commit(vivante, vSrc, ACCESS_RO);
 	dump_vPix(buf, vivante, vSrc, 1, "A-FSRC%02.2x-%p", op, pSrc);
 	dump_vPix(buf, vivante, vDst, 1, "A-FDST%02.2x-%p", op, pDst);
 #endif
@@ -1406,10 +4285,8 @@ static int vivante_accel_final_blend(struct vivante *vivante,
 	rc = vivante_blend(vivante, &clip, blend,
 			   vDst, rdst, vSrc, rsrc, nrects);
 
-	free(rects);
-
 #if 0
-	vivante_batch_wait_commit(vivante, vDst);
+	vivante_batch_wait_commit(vivante, vDst, ACCESS_RO);
 	dump_vPix(buf, vivante, vDst, PICT_FORMAT_A(pDst->format) != 0,
 		  "A-DEST%02.2x-%p", op, pDst);
 #endif
@@ -1475,6 +4352,98 @@ static Bool vivante_workaround_nonalpha(struct vivante_pixmap *vpix)
 	}
 }
 
+/*
+ * Component alpha Over is done in two passes over the destination.
+ * Each pass needs a per-channel factor, which the 2D engine provides
+ * with its COLOR blend modes, taking the colour of the other surface:
+ *
+ *  dst = dst * (1 - src.A * mask.C)	(OutReverse with src . mask)
+ *  dst = dst + src.C * mask.C		(Add of src . mask)
+ *
+ * The two terms are built in temporaries by copying the mask and
+ * multiplying it by the source colour or alpha.  Add only needs the
+ * second pass.
+ */
+static Bool vivante_composite_ca(struct vivante *vivante, ScreenPtr pScreen,
+	CARD8 op, const struct vivante_blend_op *final_op, RegionPtr region,
+	int oDst_x, int oDst_y, PicturePtr pDst, struct vivante_pixmap *vDst,
+	int xDst, int yDst, PicturePtr pSrc, struct vivante_pixmap *vSrc,
+	int xSrc, int ySrc, struct vivante_pixmap *vMask, int xMask, int yMask,
+	gcsRECT_PTR clipTemp, unsigned width, unsigned height)
+{
+	struct vivante_pixmap *vTerm[2];
+	struct vivante_blend_op blend;
+	PixmapPtr pPixTerm[2] = { NULL, NULL };
+	gcsRECT rsrc, rmask, rdst;
+	unsigned i, nterms = op == PictOpOver ? 2 : 1;
+	Bool ret = FALSE;
+
+	if (!vivante_format_valid(vivante, vMask->pict_format))
+		return FALSE;
+
+	rsrc.left = xSrc;
+	rsrc.top = ySrc;
+	rsrc.right = xSrc + width;
+	rsrc.bottom = ySrc + height;
+	rmask.left = xMask;
+	rmask.top = yMask;
+	rmask.right = rmask.left + width;
+	rmask.bottom = rmask.top + height;
+	rdst.left = 0;
+	rdst.top = 0;
+	rdst.right = width;
+	rdst.bottom = height;
+
+	/* Term 0 is src.C * mask.C, term 1 is src.A * mask.C */
+	blend = *final_op;
+	blend.src_blend = gcvSURF_BLEND_ZERO;
+	blend.dst_global_alpha = gcvSURF_GLOBAL_ALPHA_OFF;
+
+	for (i = 0; i < nterms; i++) {
+		vTerm[i] = vivante_composite_temp(vivante, pScreen, &pPixTerm[i],
+						  width, height);
+		if (!vTerm[i])
+			goto out;
+
+		if (!vivante_blend(vivante, clipTemp, NULL,
+				   vTerm[i], &rdst, vMask, &rmask, 1))
+			goto out;
+
+		blend.dst_blend = i == 0 ? gcvSURF_BLEND_COLOR :
+					   gcvSURF_BLEND_STRAIGHT;
+		if (!vivante_blend(vivante, clipTemp, &blend,
+				   vTerm[i], &rdst, vSrc, &rsrc, 1))
+			goto out;
+	}
+
+	blend = *final_op;
+	blend.src_global_alpha = gcvSURF_GLOBAL_ALPHA_OFF;
+
+	if (op == PictOpOver) {
+		blend.src_blend = gcvSURF_BLEND_ZERO;
+		blend.dst_blend = gcvSURF_BLEND_COLOR_INVERSED;
+		if (!vivante_accel_final_blend(vivante, &blend,
+					       oDst_x, oDst_y, region,
+					       pDst, vDst, xDst, yDst,
+					       pSrc, vTerm[1], 0, 0))
+			goto out;
+	}
+
+	blend.src_blend = gcvSURF_BLEND_ONE;
+	blend.dst_blend = gcvSURF_BLEND_ONE;
+	ret = vivante_accel_final_blend(vivante, &blend,
+					oDst_x, oDst_y, region,
+					pDst, vDst, xDst, yDst,
+					pSrc, vTerm[0], 0, 0);
+
+ out:
+	for (i = 0; i < nterms; i++)
+		if (pPixTerm[i])
+			vivante_temp_pool_put(vivante, pPixTerm[i]);
+
+	return ret;
+}
+
 int vivante_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
 	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
@@ -1483,10 +4452,11 @@ int vivante_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	struct vivante *vivante = vivante_get_screen_priv(pScreen);
 	struct vivante_pixmap *vDst, *vSrc, *vMask, *vTemp = NULL;
 	struct vivante_blend_op final_op;
-	PixmapPtr pPixmap, pPixTemp = NULL;
+	PixmapPtr pPixmap, pPixTemp = NULL, pPixMaskTemp = NULL;
 	RegionRec region;
 	gcsRECT clipTemp;
 	int oDst_x, oDst_y, rc;
+	Bool ca = FALSE;
 
 	/* If we can't do the op, there's no point going any further */
 	if (op >= ARRAY_SIZE(vivante_composite_op))
@@ -1531,8 +4501,18 @@ int vivante_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	if (pMask) {
 		uint32_t colour;
 
-		if (pMask->componentAlpha)
-			return FALSE;
+		/*
+		 * Component alpha is handled for Over and Add with a mask
+		 * which has both colour and alpha channels.
+		 */
+		if (pMask->componentAlpha) {
+			if (!vivante->pe20 || !pMask->pDrawable ||
+			    !PICT_FORMAT_RGB(pMask->format) ||
+			    !PICT_FORMAT_A(pMask->format) ||
+			    (op != PictOpOver && op != PictOpAdd))
+				return FALSE;
+			ca = TRUE;
+		}
 
 		/*
 		 * A PictOpOver with a mask looks like this:
@@ -1562,7 +4542,7 @@ int vivante_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		 * and hence will be incorrect.  Therefore, the destination
 		 * format must not have an alpha channel.
 		 */
-		if (op == PictOpOver && !PICT_FORMAT_A(pDst->format) &&
+		if (op == PictOpOver && !ca && !PICT_FORMAT_A(pDst->format) &&
 		    vivante_pict_solid_argb(pMask, &colour)) {
 			/* Convert the colour to A8 */
 			colour >>= 24;
@@ -1610,8 +4590,9 @@ fprintf(stderr, "%s: i: op 0x%02x src=%p,%d,%d mask=%p,%d,%d dst=%p,%d,%d %ux%u\
 	if (pMask) {
 		adjust_repeat(pMask, xMask, yMask, width, height);
 
-		/* We don't handle mask repeats (yet) */
-		if (pMask->repeat != RepeatNone)
+		/* Of the mask repeats, we can only tile */
+		if (pMask->repeat != RepeatNone &&
+		    pMask->repeat != RepeatNormal)
 			goto fallback;
 
 		/* Include the mask drawable's position on the pixmap */
@@ -1656,46 +4637,38 @@ fprintf(stderr, "%s: i: op 0x%02x src=%p,%d,%d mask=%p,%d,%d dst=%p,%d,%d %ux%u\
 	 */
 	RectBox(&clipTemp, RegionExtents(&region), -xDst, -yDst);
 
-	/*
-	 * Get a temporary pixmap.  We don't really know yet whether we're
-	 * going to use it or not.
-	 */
-	pPixTemp = pScreen->CreatePixmap(pScreen, width, height, 32, 0);
-	if (!pPixTemp)
-		goto failed;
-
-	vTemp = vivante_get_pixmap_priv(pPixTemp);
-	if (!vTemp)
-		goto failed;
-
-	vTemp->pict_format = vivante_pict_format(PICT_a8r8g8b8, FALSE);
-
 	/*
 	 * Get the source.  The source image will be described by vSrc with
 	 * offset xSrc/ySrc.  This may or may not be the temporary image, and
 	 * vSrc->pict_format describes its format, including whether the
-	 * alpha channel is valid.
+	 * alpha channel is valid.  The temporary image is only obtained
+	 * from the pool by the paths which need it.
 	 */
 	if (op == PictOpClear) {
-		if (!vivante_fill_single(vivante, vTemp, &clipTemp, 0))
+		vTemp = vivante_composite_temp(vivante, pScreen, &pPixTemp,
+					       width, height);
+		if (!vTemp ||
+		    !vivante_fill_single(vivante, vTemp, &clipTemp, 0))
 			goto failed;
-		vivante_flush(vivante);
+		vivante_submit(vivante);
 		vSrc = vTemp;
 		xSrc = 0;
 		ySrc = 0;
 	} else {
-		vSrc = vivante_acquire_src(vivante, pSrc, xSrc, ySrc,
-					   width, height,
-					   &clipTemp, pPixTemp, vTemp,
-					   &xSrc, &ySrc);
+		vSrc = vivante_acquire_src(vivante, pScreen, pSrc, xSrc, ySrc,
+					   width, height, &clipTemp,
+					   &pPixTemp, &xSrc, &ySrc);
 		if (!vSrc)
 			goto failed;
 
+		if (pPixTemp)
+			vTemp = vivante_get_pixmap_priv(pPixTemp);
+
 		/*
 		 * Apply the same work-around for a non-alpha source as for
 		 * a non-alpha destination.
 		 */
-		if (!pMask && vSrc != vTemp &&
+		if ((!pMask || ca) && vSrc != vTemp &&
 		    final_op.src_global_alpha == gcvSURF_GLOBAL_ALPHA_OFF &&
 		    vivante_workaround_nonalpha(vSrc)) {
 			final_op.src_global_alpha = gcvSURF_GLOBAL_ALPHA_ON;
@@ -1703,7 +4676,7 @@ fprintf(stderr, "%s: i: op 0x%02x src=%p,%d,%d mask=%p,%d,%d dst=%p,%d,%d %ux%u\
 		}
 	}
 
-//vivante_batch_wait_commit(vivante, vSrc);
+//vivante_batch_wait_commit(vivante, vSrc, ACCESS_RO);
 //dump_vPix(buf, vivante, vSrc, 1, "A-ISRC%02.2x-%p", op, pSrc);
 
 #if 0
@@ -1717,6 +4690,52 @@ fprintf(stderr, "%s: 0: OP 0x%02x src=%p[%p,%p,%u,%ux%u]x%dy%d mask=%p[%p,%u,%ux
 }
 #endif
 
+	/*
+	 * Get the mask, described by vMask with offset xMask/yMask.  A
+	 * repeating mask is first tiled into a temporary of its own.
+	 */
+	if (pMask) {
+		if (pMask->repeat == RepeatNone) {
+			PixmapPtr pPixMask;
+			int oMask_x, oMask_y;
+
+			pPixMask = vivante_drawable_pixmap_deltas(pMask->pDrawable,
+								  &oMask_x, &oMask_y);
+			vMask = vivante_get_pixmap_priv(pPixMask);
+			if (!vMask)
+				goto failed;
+
+			vMask->pict_format = vivante_pict_format(pMask->format, FALSE);
+			xMask += oMask_x;
+			yMask += oMask_y;
+		} else {
+			vMask = vivante_composite_temp(vivante, pScreen,
+						       &pPixMaskTemp,
+						       width, height);
+			if (!vMask ||
+			    !vivante_tile_picture(vivante, vMask, &clipTemp,
+						  pMask, xMask, yMask))
+				goto failed;
+			xMask = 0;
+			yMask = 0;
+		}
+//dump_vPix(buf, vivante, vMask, 1, "A-MASK%02.2x-%p", op, pMask);
+	}
+
+	if (ca) {
+		rc = vivante_composite_ca(vivante, pScreen, op, &final_op,
+					  &region, oDst_x, oDst_y,
+					  pDst, vDst, xDst, yDst,
+					  pSrc, vSrc, xSrc, ySrc,
+					  vMask, xMask, yMask,
+					  &clipTemp, width, height);
+		RegionUninit(&region);
+		if (!rc)
+			goto failed;
+
+		goto done;
+	}
+
 	/*
 	 * If we have a mask, handle it.  We deal with the mask by doing a
 	 * InReverse operation.  However, note that the source may already
@@ -1730,26 +4749,19 @@ fprintf(stderr, "%s: 0: OP 0x%02x src=%p[%p,%p,%u,%ux%u]x%dy%d mask=%p[%p,%u,%ux
 	 *  vSrc = vTemp
 	 */
 	if (pMask) {
-		PixmapPtr pPixMask;
 		gcsRECT rsrc, rdst;
-		int oMask_x, oMask_y;
-
-		pPixMask = vivante_drawable_pixmap_deltas(pMask->pDrawable, &oMask_x, &oMask_y);
-		vMask = vivante_get_pixmap_priv(pPixMask);
-		if (!vMask)
-			goto failed;
-
-		vMask->pict_format = vivante_pict_format(pMask->format, FALSE);
 
-		oMask_x += xMask;
-		oMask_y += yMask;
-//dump_vPix(buf, vivante, vMask, 1, "A-MASK%02.2x-%p", op, pMask);
 		rdst.left = 0;
 		rdst.top = 0;
 		rdst.right = width;
 		rdst.bottom = height;
 
 		if (vTemp != vSrc) {
+			vTemp = vivante_composite_temp(vivante, pScreen,
+						       &pPixTemp, width, height);
+			if (!vTemp)
+				goto failed;
+
 			/* Copy Source to Temp */
 			rsrc.left = xSrc;
 			rsrc.top = ySrc;
@@ -1766,14 +4778,14 @@ fprintf(stderr, "%s: 0: OP 0x%02x src=%p[%p,%p,%u,%ux%u]x%dy%d mask=%p[%p,%u,%ux
 					   vTemp, &rdst,
 					   vSrc, &rsrc, 1))
 				goto failed;
-//vivante_batch_wait_commit(vivante, vTemp);
+//vivante_batch_wait_commit(vivante, vTemp, ACCESS_RO);
 //dump_vPix(buf, vivante, vTemp, 1, "A-TMSK%02.2x-%p", op, pMask);
 		}
 
-		rsrc.left = oMask_x;
-		rsrc.top = oMask_y;
-		rsrc.right = oMask_x + width;
-		rsrc.bottom = oMask_y + height;
+		rsrc.left = xMask;
+		rsrc.top = yMask;
+		rsrc.right = xMask + width;
+		rsrc.bottom = yMask + height;
 
 #if 0
 if (pMask && pMask->pDrawable)
@@ -1819,27 +4831,740 @@ fprintf(stderr, "%s: op 0x%02x src=%p[%p,%u,%ux%u]x%dy%d mask=%p[%p,%u,%ux%u]x%d
  failed:
 	RegionUninit(&region);
 
-	if (pPixTemp) {
-		ScreenPtr pScreen = pPixTemp->drawable.pScreen;
-		pScreen->DestroyPixmap(pPixTemp);
-	}
+	if (pPixMaskTemp)
+		vivante_temp_pool_put(vivante, pPixMaskTemp);
+	if (pPixTemp)
+		vivante_temp_pool_put(vivante, pPixTemp);
 	return FALSE;
 
  done:
-	if (pPixTemp) {
-		ScreenPtr pScreen = pPixTemp->drawable.pScreen;
-		pScreen->DestroyPixmap(pPixTemp);
+	if (pPixMaskTemp)
+		vivante_temp_pool_put(vivante, pPixMaskTemp);
+	if (pPixTemp)
+		vivante_temp_pool_put(vivante, pPixTemp);
+	return TRUE;
+}
+
+#define VIVANTE_GLYPH_DELETED ((GlyphPtr)1)
+
+static struct vivante_glyph_cache_entry *vivante_glyph_cache_lookup(
+	struct vivante_glyph_cache *cache, GlyphPtr glyph)
+{
+	unsigned h = ((uintptr_t)glyph >> 4) & (VIVANTE_GLYPH_CACHE_HASH - 1);
+
+	while (cache->hash[h].glyph) {
+		if (cache->hash[h].glyph == glyph)
+			break;
+		h = (h + 1) & (VIVANTE_GLYPH_CACHE_HASH - 1);
+	}
+	return &cache->hash[h];
+}
+
+static void vivante_glyph_cache_page_reset(struct vivante_glyph_cache *cache,
+	unsigned p)
+{
+	cache->page[p].count = 0;
+	cache->page[p].shelf_x = 0;
+	cache->page[p].shelf_y = 0;
+	cache->page[p].shelf_h = 0;
+	cache->resets++;
+}
+
+/*
+ * Rebuild the hash without deleted entries, also dropping the entries
+ * of page 'drop', which is then empty.
+ */
+static void vivante_glyph_cache_rehash(struct vivante_glyph_cache *cache,
+	unsigned drop)
+{
+	struct vivante_glyph_cache_entry *old;
+	unsigned i;
+
+	old = malloc(sizeof(cache->hash));
+	if (old)
+		memcpy(old, cache->hash, sizeof(cache->hash));
+
+	memset(cache->hash, 0, sizeof(cache->hash));
+	cache->used = 0;
+
+	if (!old) {
+		/* Without a copy of the old hash, every page is emptied */
+		for (i = 0; i < VIVANTE_GLYPH_PAGES; i++)
+			vivante_glyph_cache_page_reset(cache, i);
+		return;
+	}
+
+	vivante_glyph_cache_page_reset(cache, drop);
+
+	for (i = 0; i < VIVANTE_GLYPH_CACHE_HASH; i++) {
+		if (!old[i].glyph || old[i].glyph == VIVANTE_GLYPH_DELETED ||
+		    old[i].page == drop)
+			continue;
+
+		*vivante_glyph_cache_lookup(cache, old[i].glyph) = old[i];
+		cache->used++;
+	}
+
+	free(old);
+}
+
+void vivante_glyph_cache_remove(struct vivante *vivante, GlyphPtr glyph)
+{
+	struct vivante_glyph_cache *cache = &vivante->glyph_cache;
+	struct vivante_glyph_cache_page *page;
+	struct vivante_glyph_cache_entry *e;
+
+	e = vivante_glyph_cache_lookup(cache, glyph);
+	if (e->glyph != glyph)
+		return;
+
+	e->glyph = VIVANTE_GLYPH_DELETED;
+	cache->evictions++;
+
+	/* Once a page holds no live glyphs, its space can all be reused */
+	page = &cache->page[e->page];
+	if (--page->count == 0) {
+		page->shelf_x = 0;
+		page->shelf_y = 0;
+		page->shelf_h = 0;
+	}
+}
+
+void vivante_glyph_cache_fini(struct vivante *vivante)
+{
+	struct vivante_glyph_cache *cache = &vivante->glyph_cache;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_GLYPH_PAGES; i++) {
+		PixmapPtr pixmap = cache->page[i].pixmap;
+
+		cache->page[i].pixmap = NULL;
+		if (pixmap)
+			pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+	}
+
+	memset(cache->hash, 0, sizeof(cache->hash));
+	memset(cache->page, 0, sizeof(cache->page));
+	cache->used = 0;
+}
+
+/* Find space for a w x h glyph in a page, using simple shelves */
+static Bool vivante_glyph_cache_alloc(struct vivante_glyph_cache *cache,
+	unsigned p, int w, int h, struct vivante_glyph_cache_entry *e)
+{
+	struct vivante_glyph_cache_page *page = &cache->page[p];
+
+	if (cache->used >= VIVANTE_GLYPH_CACHE_HASH * 3 / 4)
+		return FALSE;
+
+	if (page->shelf_x + w > VIVANTE_GLYPH_CACHE_SIZE) {
+		page->shelf_y += page->shelf_h;
+		page->shelf_x = 0;
+		page->shelf_h = 0;
+	}
+
+	if (page->shelf_y + h > VIVANTE_GLYPH_CACHE_SIZE)
+		return FALSE;
+
+	e->x = page->shelf_x;
+	e->y = page->shelf_y;
+	e->page = p;
+	page->shelf_x += w;
+	if (page->shelf_h < h)
+		page->shelf_h = h;
+
+	return TRUE;
+}
+
+static Bool vivante_glyph_cache_page_init(ScreenPtr pScreen,
+	struct vivante_glyph_cache_page *page)
+{
+	struct vivante_pixmap *vPix;
+	PixmapPtr pixmap;
+
+	if (page->pixmap)
+		return TRUE;
+
+	pixmap = pScreen->CreatePixmap(pScreen, VIVANTE_GLYPH_CACHE_SIZE,
+				       VIVANTE_GLYPH_CACHE_SIZE, 32, 0);
+	if (!pixmap)
+		return FALSE;
+
+	vPix = vivante_get_pixmap_priv(pixmap);
+	if (!vPix) {
+		pScreen->DestroyPixmap(pixmap);
+		return FALSE;
+	}
+
+	vPix->pict_format = gcvSURF_A8R8G8B8;
+	page->pixmap = pixmap;
+
+	return TRUE;
+}
+
+/* Copy a glyph's image into its page, converting to 32bpp ARGB */
+static void vivante_glyph_cache_write(PixmapPtr pixmap,
+	const struct vivante_glyph_cache_entry *e, PicturePtr pict,
+	int w, int h)
+{
+	PixmapPtr pGlyph = (PixmapPtr)pict->pDrawable;
+	const uint8_t *src;
+	int x, y;
+
+	vivante_prepare_drawable(pict->pDrawable, ACCESS_RO);
+
+	src = pGlyph->devPrivate.ptr;
+	for (y = 0; y < h; y++, src += pGlyph->devKind) {
+		uint32_t *dst = (uint32_t *)((char *)pixmap->devPrivate.ptr +
+					     (e->y + y) * pixmap->devKind);
+
+		dst += e->x;
+		switch (pict->format) {
+		case PICT_a8r8g8b8:
+			memcpy(dst, src, w * sizeof(*dst));
+			break;
+		case PICT_a8:
+			for (x = 0; x < w; x++)
+				dst[x] = src[x] * 0x01010101;
+			break;
+		case PICT_a1:
+			for (x = 0; x < w; x++)
+				dst[x] = vivante_stipple_bit(src, x) ? ~0 : 0;
+			break;
+		}
+	}
+
+	vivante_finish_drawable(pict->pDrawable, ACCESS_RO);
+}
+
+/*
+ * Make sure all the glyphs are in the cache, and calculate their
+ * extents and the set of pages they are on.  If a page fills up, it is
+ * emptied and the glyphs for this call loaded again; if they still do
+ * not fit, we fail and the caller falls back.  With 'disjoint', we also
+ * fail if the glyphs overlap.
+ */
+static Bool vivante_glyph_cache_upload(struct vivante *vivante,
+	ScreenPtr pScreen, int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+	Bool disjoint, BoxPtr extents, unsigned *pages)
+{
+	struct vivante_glyph_cache *cache = &vivante->glyph_cache;
+	Bool mapped[VIVANTE_GLYPH_PAGES] = { FALSE, };
+	Bool retried = FALSE, ret = FALSE;
+	GlyphPtr *g;
+	int i, n, x, y;
+	unsigned p;
+
+ restart:
+	extents->x1 = extents->y1 = MAXSHORT;
+	extents->x2 = extents->y2 = MINSHORT;
+	*pages = 0;
+
+	for (i = x = y = 0, g = glyphs; i < nlist; i++) {
+		x += list[i].xOff;
+		y += list[i].yOff;
+		for (n = list[i].len; n; n--, g++) {
+			GlyphPtr glyph = *g;
+			struct vivante_glyph_cache_entry *e;
+			int w = glyph->info.width, h = glyph->info.height;
+			BoxRec box;
+			PicturePtr pict;
+
+			box.x1 = x - glyph->info.x;
+			box.y1 = y - glyph->info.y;
+			box.x2 = box.x1 + w;
+			box.y2 = box.y1 + h;
+			x += glyph->info.xOff;
+			y += glyph->info.yOff;
+
+			if (w == 0 || h == 0)
+				continue;
+
+			if (disjoint &&
+			    box.x1 < extents->x2 && box.x2 > extents->x1 &&
+			    box.y1 < extents->y2 && box.y2 > extents->y1)
+				goto out;
+
+			extents->x1 = min(extents->x1, box.x1);
+			extents->y1 = min(extents->y1, box.y1);
+			extents->x2 = max(extents->x2, box.x2);
+			extents->y2 = max(extents->y2, box.y2);
+
+			e = vivante_glyph_cache_lookup(cache, glyph);
+			if (e->glyph) {
+				*pages |= 1 << e->page;
+				cache->hits++;
+				continue;
+			}
+
+			pict = GetGlyphPicture(glyph, pScreen);
+			if (!pict)
+				continue;
+
+			switch (pict->format) {
+			case PICT_a8:
+			case PICT_a1:
+				p = VIVANTE_GLYPH_PAGE_A8;
+				break;
+			case PICT_a8r8g8b8:
+				p = VIVANTE_GLYPH_PAGE_ARGB;
+				break;
+			default:
+				goto out;
+			}
+
+			if (w > VIVANTE_GLYPH_CACHE_MAX ||
+			    h > VIVANTE_GLYPH_CACHE_MAX)
+				goto out;
+
+			cache->misses++;
+
+			if (!vivante_glyph_cache_page_init(pScreen,
+							   &cache->page[p]))
+				goto out;
+
+			if (!vivante_glyph_cache_alloc(cache, p, w, h, e)) {
+				if (retried)
+					goto out;
+
+				/*
+				 * Start again with an empty page, and if
+				 * the hash is still too full, empty the
+				 * other page too.
+				 */
+				vivante_glyph_cache_rehash(cache, p);
+				if (cache->used >= VIVANTE_GLYPH_CACHE_HASH * 3 / 4)
+					vivante_glyph_cache_rehash(cache, p ^ 1);
+				retried = TRUE;
+				goto restart;
+			}
+
+			if (!mapped[p]) {
+				vivante_prepare_drawable(&cache->page[p].pixmap->drawable,
+							 ACCESS_RW);
+				mapped[p] = TRUE;
+			}
+
+			vivante_glyph_cache_write(cache->page[p].pixmap, e,
+						  pict, w, h);
+			*pages |= 1 << p;
+			e->glyph = glyph;
+			cache->page[p].count++;
+			cache->used++;
+		}
+	}
+
+	ret = extents->x1 < extents->x2 && extents->y1 < extents->y2;
+
+ out:
+	for (p = 0; p < VIVANTE_GLYPH_PAGES; p++)
+		if (mapped[p])
+			vivante_finish_drawable(&cache->page[p].pixmap->drawable,
+						ACCESS_RW);
+
+	return ret;
+}
+
+/*
+ * Render glyphs by building the mask on the GPU: the glyphs are added
+ * into a cleared ARGB temporary from the cache pages with batched
+ * blends, and the source is then composited through that temporary.
+ * A8 masks may contain either kind of glyph, and only the alpha of the
+ * temporary is used.  ARGB masks, which are component alpha, must only
+ * contain ARGB glyphs.  Without a mask format, we handle Over and Add
+ * of non-overlapping glyphs of one kind, where compositing through the
+ * combined mask gives the same result as compositing each glyph in
+ * turn.
+ */
+Bool vivante_accel_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int nlist,
+	GlyphListPtr list, GlyphPtr *glyphs)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct vivante *vivante = vivante_get_screen_priv(pScreen);
+	struct vivante_glyph_cache *cache = &vivante->glyph_cache;
+	struct vivante_pixmap *vMask;
+	PixmapPtr pMaskPixmap;
+	PicturePtr pMask;
+	PictFormatPtr f;
+	BoxRec extents;
+	gcsRECT clip, *rects;
+	GlyphPtr *g;
+	CARD32 component_alpha;
+	int xDst = list->xOff, yDst = list->yOff;
+	int width, height, ox, oy, i, n, err;
+	unsigned chunk, p, nrects, pages;
+
+	if (maskFormat) {
+		if (maskFormat->format != PICT_a8 &&
+		    maskFormat->format != PICT_a8r8g8b8)
+			return FALSE;
+	} else if (op != PictOpOver && op != PictOpAdd) {
+		return FALSE;
+	}
+
+	if (pDst->alphaMap || pSrc->alphaMap)
+		return FALSE;
+
+	/* Leave drawing to system memory pixmaps to the CPU */
+	if (!vivante_get_pixmap_priv(vivante_drawable_pixmap_deltas(pDst->pDrawable,
+								  &ox, &oy)))
+		return FALSE;
+
+	if (!vivante_glyph_cache_upload(vivante, pScreen, nlist, list, glyphs,
+					!maskFormat, &extents, &pages))
+		return FALSE;
+
+	if (maskFormat ? maskFormat->format == PICT_a8r8g8b8 :
+			 pages != 1 << VIVANTE_GLYPH_PAGE_A8) {
+		if (pages != 1 << VIVANTE_GLYPH_PAGE_ARGB)
+			return FALSE;
+		component_alpha = TRUE;
+	} else {
+		component_alpha = FALSE;
+	}
+
+	width = extents.x2 - extents.x1;
+	height = extents.y2 - extents.y1;
+
+	chunk = vivante->max_rect_count;
+	rects = vivante_scratch_alloc(&vivante->scratch,
+				      2 * chunk * sizeof *rects);
+	if (!rects)
+		return FALSE;
+
+	f = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+	if (!f)
+		return FALSE;
+
+	pMaskPixmap = vivante_temp_pool_get(vivante, pScreen, width, height);
+	if (!pMaskPixmap)
+		return FALSE;
+
+	vMask = vivante_get_pixmap_priv(pMaskPixmap);
+	vMask->pict_format = gcvSURF_A8R8G8B8;
+
+	clip.left = 0;
+	clip.top = 0;
+	clip.right = width;
+	clip.bottom = height;
+
+	if (!vivante_fill_single(vivante, vMask, &clip, 0))
+		goto failed;
+
+	/* Add the glyphs from each page into the mask */
+	for (p = 0; p < VIVANTE_GLYPH_PAGES; p++) {
+		struct vivante_pixmap *vPage;
+		int x = -extents.x1, y = -extents.y1;
+
+		if (!cache->page[p].count)
+			continue;
+
+		vPage = vivante_get_pixmap_priv(cache->page[p].pixmap);
+
+		for (i = nrects = 0, g = glyphs; i < nlist; i++) {
+			x += list[i].xOff;
+			y += list[i].yOff;
+			for (n = list[i].len; n; n--) {
+				GlyphPtr glyph = *g++;
+				const struct vivante_glyph_cache_entry *e;
+				gcsRECT *src = &rects[nrects];
+				gcsRECT *dst = &rects[chunk + nrects];
+
+				dst->left = x - glyph->info.x;
+				dst->top = y - glyph->info.y;
+				x += glyph->info.xOff;
+				y += glyph->info.yOff;
+
+				if (!glyph->info.width || !glyph->info.height)
+					continue;
+
+				e = vivante_glyph_cache_lookup(cache, glyph);
+				if (e->glyph != glyph || e->page != p)
+					continue;
+
+				dst->right = dst->left + glyph->info.width;
+				dst->bottom = dst->top + glyph->info.height;
+				src->left = e->x;
+				src->top = e->y;
+				src->right = e->x + glyph->info.width;
+				src->bottom = e->y + glyph->info.height;
+
+				if (++nrects == chunk) {
+					if (!vivante_blend(vivante, &clip,
+							   &vivante_composite_op[PictOpAdd],
+							   vMask, rects + chunk,
+							   vPage, rects, nrects))
+						goto failed;
+					nrects = 0;
+				}
+			}
+		}
+
+		if (nrects &&
+		    !vivante_blend(vivante, &clip,
+				   &vivante_composite_op[PictOpAdd],
+				   vMask, rects + chunk, vPage, rects, nrects))
+			goto failed;
 	}
+
+	pMask = CreatePicture(0, &pMaskPixmap->drawable, f, CPComponentAlpha,
+			      &component_alpha, serverClient, &err);
+	if (!pMask)
+		goto failed;
+	ValidatePicture(pMask);
+
+	CompositePicture(op, pSrc, pMask, pDst,
+			 xSrc + extents.x1 - xDst, ySrc + extents.y1 - yDst,
+			 0, 0, extents.x1, extents.y1, width, height);
+
+	FreePicture(pMask, 0);
+	vivante_temp_pool_put(vivante, pMaskPixmap);
+
 	return TRUE;
+
+ failed:
+	vivante_temp_pool_put(vivante, pMaskPixmap);
+	return FALSE;
 }
 #endif
 
+static void vivante_dump_freelist(struct vivante *vivante, const char *name,
+	struct vivante_freelist *fl)
+{
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: %s allocator: %lu hits, %lu misses\n",
+		   name, fl->hits, fl->misses);
+}
+
+void vivante_dump_stats(struct vivante *vivante)
+{
+	static const char *state_names[VIVANTE_NR_STATES] = {
+		[VIVANTE_STATE_TARGET] = "target",
+		[VIVANTE_STATE_SOURCE] = "source",
+		[VIVANTE_STATE_CLIP] = "clip",
+		[VIVANTE_STATE_BRUSH] = "brush",
+		[VIVANTE_STATE_BLEND] = "blend",
+		[VIVANTE_STATE_TRANSPARENCY] = "transparency",
+	};
+	static const char *op_names[VIVANTE_NR_OPS] = {
+		[VIVANTE_OP_FILL] = "fill",
+		[VIVANTE_OP_COPY] = "copy",
+		[VIVANTE_OP_PUTIMAGE] = "put image",
+		[VIVANTE_OP_READBACK] = "readback",
+	};
+	unsigned i;
+
+	vivante_dump_freelist(vivante, "pixmap", &vivante->pixmap_freelist);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: tile cache: %lu hits, %lu misses\n",
+		   vivante->tile_cache.hits, vivante->tile_cache.misses);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: composite temp pool: %lu hits, %lu misses\n",
+		   vivante->temp_pool.hits, vivante->temp_pool.misses);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: glyph atlas: %lu hits, %lu misses, %lu resets\n",
+		   vivante->glyph_atlas.hits, vivante->glyph_atlas.misses,
+		   vivante->glyph_atlas.resets);
+#ifdef RENDER
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: render glyph cache: %lu hits, %lu misses, %lu evictions, %lu page resets\n",
+		   vivante->glyph_cache.hits, vivante->glyph_cache.misses,
+		   vivante->glyph_cache.evictions,
+		   vivante->glyph_cache.resets);
+#endif
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: scratch arena: %zu bytes, high water %zu bytes\n",
+		   vivante->scratch.size, vivante->scratch.high_water);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: bo cache: %lu hits, %lu misses, %lu trimmed\n",
+		   vivante->bo_cache.hits, vivante->bo_cache.misses,
+		   vivante->bo_cache.trimmed);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: SHMEM bos: %lu GPU maps, %lu unmaps, %lu cleans, %lu invalidates%s\n",
+		   vivante->bo_stats.maps, vivante->bo_stats.unmaps,
+		   vivante->bo_stats.cleans, vivante->bo_stats.invalidates,
+		   vivante->bo_cache_maint ? "" : " (unmapping on CPU access)");
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: staging: %lu uploads in %lu bands, %lu waits\n",
+		   vivante->staging.uploads, vivante->staging.bands,
+		   vivante->staging.waits);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: readback: %lu reads, %lu buffer grows, %lu one-off maps\n",
+		   vivante->readback.reads, vivante->readback.grows,
+		   vivante->readback.oneoff);
+#ifdef VIVANTE_BATCH
+	vivante_dump_freelist(vivante, "batch", &vivante->batch_freelist);
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: batch waits: %lu signalled, %lu polled, %lluus total, %luus max\n",
+		   vivante->batch_wait.signalled, vivante->batch_wait.polled,
+		   vivante->batch_wait.total_us, vivante->batch_wait.max_us);
+#endif
+
+	for (i = 0; i < VIVANTE_NR_STATES; i++)
+		xf86DrvMsg(vivante->scrnIndex, X_INFO,
+			   "vivante: %s state: %lu loaded, %lu skipped\n",
+			   state_names[i], vivante->state.issued[i],
+			   vivante->state.skipped[i]);
+
+	for (i = 0; i < VIVANTE_NR_OPS; i++)
+		xf86DrvMsg(vivante->scrnIndex, X_INFO,
+			   "vivante: %s: %lu CPU, %lu GPU (threshold %ld pixels)\n",
+			   op_names[i], vivante->cost.cpu[i],
+			   vivante->cost.gpu[i], vivante->cost.threshold[i]);
+
+	if (vivante->commit_stats.commits) {
+		const struct vivante_commit_stats *s = &vivante->commit_stats;
+
+		xf86DrvMsg(vivante->scrnIndex, X_INFO,
+			   "vivante: %lu commits (%lu early): %llu rects, %llu pixels; average %llu rects, %llu pixels; largest %u rects, %lu pixels\n",
+			   s->commits, s->early, s->ops, s->pixels,
+			   s->ops / s->commits, s->pixels / s->commits,
+			   s->max_ops, s->max_pixels);
+	}
+}
+
+static uint64_t vivante_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Calibrate the CPU-vs-GPU thresholds which were not configured.  The
+ * fixed cost of a GPU operation is taken as the time for a minimal
+ * fill to make a round trip through the GPU.  This is compared with
+ * the CPU's cost per pixel for writing cacheable memory (fills, and
+ * half that for copies, which read as well as write), and for reading
+ * write-combined memory (readback).  The staging buffer is used for
+ * both the GPU fill and the write-combined reads.
+ */
+#define CALIBRATE_LOOPS	4
+
+static void vivante_cost_calibrate(struct vivante *vivante)
+{
+	struct vivante_cost *c = &vivante->cost;
+	struct vivante_staging_slot *slot = &vivante->staging.slot[0];
+	unsigned npix = VIVANTE_STAGING_SLOT_SIZE / sizeof(uint32_t);
+	uint64_t t, gpu_ns = ~0ULL, write_ns = ~0ULL, read_ns = ~0ULL;
+	volatile const uint32_t *wc;
+	uint32_t sum = 0;
+	gceSTATUS err;
+	gcsRECT rect;
+	void *buf;
+	unsigned i, j;
+
+	buf = malloc(VIVANTE_STAGING_SLOT_SIZE);
+	if (!buf)
+		return;
+
+	rect.left = rect.top = 0;
+	rect.right = rect.bottom = 1;
+
+	for (i = 0; i < CALIBRATE_LOOPS; i++) {
+		t = vivante_ns();
+		vivante_disable_alpha_blend(vivante);
+		err = vivante_load_solid_brush(vivante, gcvSURF_A8R8G8B8, i);
+		if (err == gcvSTATUS_OK)
+			err = vivante_set_clipping(vivante, &rect);
+		if (err == gcvSTATUS_OK)
+			err = vivante_set_target(vivante, slot->handle, 64);
+		if (err == gcvSTATUS_OK)
+			err = gco2D_Blit(vivante->e2d, 1, &rect, 0xf0, 0xf0,
+					 gcvSURF_A8R8G8B8);
+		if (err != gcvSTATUS_OK) {
+			vivante_error(vivante, "calibration blit", err);
+			free(buf);
+			return;
+		}
+		vivante_commit(vivante, TRUE);
+		gpu_ns = min(gpu_ns, vivante_ns() - t);
+
+		t = vivante_ns();
+		memset(buf, i, VIVANTE_STAGING_SLOT_SIZE);
+		write_ns = min(write_ns, vivante_ns() - t);
+
+		t = vivante_ns();
+		for (j = 0, wc = slot->ptr; j < npix; j++)
+			sum += wc[j];
+		read_ns = min(read_ns, vivante_ns() - t);
+	}
+
+	free(buf);
+
+	/* Avoid the reads being optimised away */
+	if (sum == 0x5a5a5a5a)
+		write_ns++;
+
+	write_ns = max(write_ns, 1);
+	read_ns = max(read_ns, 1);
+
+	t = gpu_ns * npix / write_ns;
+	if (c->threshold[VIVANTE_OP_FILL] < 0)
+		c->threshold[VIVANTE_OP_FILL] = t;
+	if (c->threshold[VIVANTE_OP_COPY] < 0)
+		c->threshold[VIVANTE_OP_COPY] = t / 2;
+	if (c->threshold[VIVANTE_OP_PUTIMAGE] < 0)
+		c->threshold[VIVANTE_OP_PUTIMAGE] = t / 2;
+	if (c->threshold[VIVANTE_OP_READBACK] < 0)
+		c->threshold[VIVANTE_OP_READBACK] = gpu_ns * npix / read_ns;
+
+	xf86DrvMsg(vivante->scrnIndex, X_PROBED,
+		   "vivante: GPU round trip %lluus, CPU %llu ns/kpixel write, %llu ns/kpixel uncached read\n",
+		   (unsigned long long)gpu_ns / 1000,
+		   (unsigned long long)write_ns * 1000 / npix,
+		   (unsigned long long)read_ns * 1000 / npix);
+}
+
+static void vivante_cost_init(struct vivante *vivante)
+{
+	/* Used when calibration is not possible */
+	static const long defaults[VIVANTE_NR_OPS] = {
+		[VIVANTE_OP_FILL] = 256,
+		[VIVANTE_OP_COPY] = 128,
+		[VIVANTE_OP_PUTIMAGE] = 128,
+		[VIVANTE_OP_READBACK] = 1024,
+	};
+	struct vivante_cost *c = &vivante->cost;
+	unsigned i;
+
+	for (i = 0; i < VIVANTE_NR_OPS; i++)
+		if (c->threshold[i] < 0)
+			break;
+
+	if (i < VIVANTE_NR_OPS && vivante->staging.bo)
+		vivante_cost_calibrate(vivante);
+
+	for (i = 0; i < VIVANTE_NR_OPS; i++) {
+		if (c->threshold[i] < 0)
+			c->threshold[i] = defaults[i];
+		else if (c->threshold[i] > VIVANTE_MAX_THRESHOLD)
+			c->threshold[i] = VIVANTE_MAX_THRESHOLD;
+	}
+
+	xf86DrvMsg(vivante->scrnIndex, X_INFO,
+		   "vivante: CPU thresholds: fill %ld, copy %ld, put image %ld, readback %ld pixels\n",
+		   c->threshold[VIVANTE_OP_FILL],
+		   c->threshold[VIVANTE_OP_COPY],
+		   c->threshold[VIVANTE_OP_PUTIMAGE],
+		   c->threshold[VIVANTE_OP_READBACK]);
+}
+
 Bool vivante_accel_init(struct vivante *vivante)
 {
 	gceCHIPMODEL model;
 	gctUINT32 rev, feat, minfeat;
 	gceSTATUS ret;
 
+#ifdef VIVANTE_BATCH
+	xorg_list_init(&vivante->batch_list);
+	vivante_freelist_init(&vivante->batch_freelist,
+			      sizeof(struct vivante_batch));
+#endif
+
 	ret = gcoOS_Construct(gcvNULL, &vivante->os);
 	if (ret != gcvSTATUS_OK) {
 		xf86DrvMsg(vivante->scrnIndex, X_ERROR,
@@ -1876,6 +5601,25 @@ Bool vivante_accel_init(struct vivante *vivante)
 
 	vivante->max_rect_count = gco2D_GetMaximumRectCount();
 
+	/*
+	 * Alpha blending is disabled, and the engine opaque, when the
+	 * 2D engine is created.
+	 */
+	vivante->state.src_transparency = gcv2D_OPAQUE;
+	vivante->state.pat_transparency = gcv2D_OPAQUE;
+	vivante->state.valid = 1 << VIVANTE_STATE_BLEND |
+			       1 << VIVANTE_STATE_TRANSPARENCY;
+
+#ifdef VIVANTE_BATCH
+	if (!vivante_batch_new_page(vivante))
+		return FALSE;
+#endif
+
+	/* Without the staging ring, PutImage falls back to the CPU */
+	vivante_staging_init(vivante);
+
+	vivante_cost_init(vivante);
+
 	return TRUE;
 }
 
@@ -1883,6 +5627,31 @@ void vivante_accel_shutdown(struct vivante *vivante)
 {
 	if (vivante->hal) {
 		gcoHAL_Commit(vivante->hal, gcvTRUE);
+		vivante_staging_fini(vivante);
+		vivante_readback_fini(vivante);
+#ifdef VIVANTE_BATCH
+		{
+			struct vivante_batch *batch, *n;
+			unsigned i;
+
+			/* The GPU is now idle, so all batches are complete */
+			if (vivante->batch)
+				vivante_batch_destroy(vivante, vivante->batch);
+			xorg_list_for_each_entry_safe(batch, n,
+					&vivante->batch_list, node)
+				vivante_batch_destroy(vivante, batch);
+
+			for (i = 0; i < vivante->batch_nr_pages; i++)
+				vivante_batch_free_page(vivante,
+							vivante->batch_page[i]);
+
+			while (vivante->batch_nr_signals)
+				gcoOS_DestroySignal(vivante->os,
+					vivante->batch_signal[--vivante->batch_nr_signals]);
+
+			vivante_freelist_fini(&vivante->batch_freelist);
+		}
+#endif
 		gcoHAL_Destroy(vivante->hal);
 	}
 	if (vivante->os)
@@ -19,6 +19,7 @@ struct armada_drm_info;
 
 /* Debugging options */
 #define DEBUG_CHECK_DRAWABLE_USE
+#undef DEBUG_CHECK_POLYLINES
 #undef DEBUG_BATCH
 #undef DEBUG_MAP
 #undef DEBUG_PIXMAP
@@ -41,6 +42,256 @@ struct armada_drm_info;
 
 #define dbg(fmt...) fprintf(stderr, fmt)
 
+/* Free-list allocator for fixed size objects */
+struct vivante_freelist {
+	void *free;
+	void *chunks;
+	size_t size;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/*
+ * Scratch arena for temporary arrays in the drawing paths.  Allocations
+ * are carved sequentially from 'base'; anything which does not fit is
+ * malloc'd and chained on 'overflow'.  The whole arena is released in
+ * one go by vivante_scratch_reset(), which also grows 'base' to cover
+ * the peak usage so that the next cycle does not need to overflow.
+ */
+#define VIVANTE_SCRATCH_SIZE 16384
+
+struct vivante_scratch {
+	char *base;
+	size_t size;
+	size_t used;
+	size_t total;
+	size_t high_water;
+	void *overflow;
+};
+
+#ifdef RENDER
+struct vivante_blend_op {
+	gceSURF_BLEND_FACTOR_MODE src_blend;
+	gceSURF_BLEND_FACTOR_MODE dst_blend;
+	gceSURF_GLOBAL_ALPHA_MODE src_global_alpha;
+	gceSURF_GLOBAL_ALPHA_MODE dst_global_alpha;
+	uint8_t src_alpha;
+	uint8_t dst_alpha;
+};
+#endif
+
+enum {
+	VIVANTE_STATE_TARGET,
+	VIVANTE_STATE_SOURCE,
+	VIVANTE_STATE_CLIP,
+	VIVANTE_STATE_BRUSH,
+	VIVANTE_STATE_BLEND,
+	VIVANTE_STATE_TRANSPARENCY,
+	VIVANTE_NR_STATES,
+};
+
+/*
+ * Shadow copy of the 2D engine state, so that we can avoid reloading
+ * state which has not changed since the previous operation.  'valid'
+ * is a bitmask of (1 << VIVANTE_STATE_xxx) for the entries which are
+ * known to match the engine.
+ */
+struct vivante_2d_state {
+	unsigned valid;
+	uint32_t target_handle;
+	unsigned target_pitch;
+	uint32_t source_handle;
+	unsigned source_pitch;
+	gceSURF_FORMAT source_format;
+	unsigned source_width;
+	unsigned source_height;
+	gcsRECT clip;
+	gceSURF_FORMAT brush_format;
+	uint32_t brush_colour;
+	gce2D_TRANSPARENCY src_transparency;
+	gce2D_TRANSPARENCY pat_transparency;
+#ifdef RENDER
+	Bool blend_enabled;
+	struct vivante_blend_op blend;
+#endif
+	unsigned long issued[VIVANTE_NR_STATES];
+	unsigned long skipped[VIVANTE_NR_STATES];
+};
+
+/* Maximum number of pages in the batch serial ring */
+#define VIVANTE_MAX_BATCH_PAGES 16
+
+/* Number of idle batch signals kept for reuse */
+#define VIVANTE_BATCH_SIGNALS 16
+
+/*
+ * Small tiles are replicated into larger pixmaps, so that tiled fills
+ * need fewer blits.  The expanded pixmap is at least this size, and a
+ * whole multiple of the tile size, so it can be used at any alignment.
+ */
+#define VIVANTE_TILE_CACHE_SIZE 256
+#define VIVANTE_TILE_CACHE_ENTRIES 4
+
+struct vivante_tile_cache {
+	struct {
+		struct vivante_pixmap *tile;
+		PixmapPtr pixmap;
+	} entry[VIVANTE_TILE_CACHE_ENTRIES];
+	unsigned next;
+	unsigned long hits, misses;
+};
+
+/*
+ * Pool of GPU-resident temporary surfaces for Composite, sized in
+ * power-of-two buckets.  Larger temporaries are not pooled.
+ */
+#define VIVANTE_TEMP_POOL_ENTRIES	6
+#define VIVANTE_TEMP_POOL_MIN		64
+#define VIVANTE_TEMP_POOL_MAX		1024
+#define VIVANTE_TEMP_POOL_EXPIRE	2000	/* ms */
+
+struct vivante_temp_pool {
+	struct {
+		PixmapPtr pixmap;
+		CARD32 time;
+		Bool busy;
+	} entry[VIVANTE_TEMP_POOL_ENTRIES];
+	unsigned long hits, misses;
+};
+
+/* Core font glyph atlas */
+#define VIVANTE_GLYPH_ATLAS_SIZE 512
+#define VIVANTE_GLYPH_HASH_SIZE 1024
+
+struct vivante_glyph_entry {
+	FontPtr font;
+	CharInfoPtr pci;
+	uint16_t x, y;
+};
+
+struct vivante_glyph_atlas {
+	PixmapPtr pixmap;
+	struct vivante_glyph_entry hash[VIVANTE_GLYPH_HASH_SIZE];
+	unsigned count;
+	uint16_t shelf_x, shelf_y, shelf_h;
+	unsigned long hits, misses, resets;
+};
+
+#ifdef RENDER
+/*
+ * Render glyph cache.  A8 (and A1) glyphs are kept in one atlas page
+ * with their coverage replicated into all four channels, and ARGB
+ * glyphs in another; both pages are 32bpp, which is what the 2D core
+ * can blend from.  Glyphs are located through a hash keyed on the
+ * GlyphPtr, and dropped from it when the glyph is unrealized.
+ */
+#define VIVANTE_GLYPH_CACHE_SIZE	512
+#define VIVANTE_GLYPH_CACHE_MAX		64	/* largest cached glyph */
+#define VIVANTE_GLYPH_CACHE_HASH	4096
+
+enum {
+	VIVANTE_GLYPH_PAGE_A8,
+	VIVANTE_GLYPH_PAGE_ARGB,
+	VIVANTE_GLYPH_PAGES,
+};
+
+struct vivante_glyph_cache_entry {
+	GlyphPtr glyph;
+	uint16_t x, y;
+	uint8_t page;
+};
+
+struct vivante_glyph_cache_page {
+	PixmapPtr pixmap;
+	unsigned count;
+	uint16_t shelf_x, shelf_y, shelf_h;
+};
+
+struct vivante_glyph_cache {
+	struct vivante_glyph_cache_page page[VIVANTE_GLYPH_PAGES];
+	struct vivante_glyph_cache_entry hash[VIVANTE_GLYPH_CACHE_HASH];
+	unsigned used;
+	unsigned long hits, misses, evictions, resets;
+};
+#endif
+
+/* Ring of GPU-mapped staging slots used to upload PutImage data */
+#define VIVANTE_STAGING_SLOTS		4
+#define VIVANTE_STAGING_SLOT_SIZE	(256 * 1024)
+
+struct vivante_staging_slot {
+	void *ptr;
+	uint32_t handle;
+	gctSIGNAL signal;
+	uint32_t serial;
+	Bool busy;
+};
+
+struct vivante_staging {
+	struct drm_armada_bo *bo;
+	void *info;
+	uint32_t handle;
+	struct vivante_staging_slot slot[VIVANTE_STAGING_SLOTS];
+	unsigned next;
+	uint32_t serial;
+	uint32_t committed;
+	unsigned long uploads, bands, waits;
+};
+
+/*
+ * Cacheable buffer kept mapped to the GPU for GetImage and GetSpans
+ * readback, grown on demand up to VIVANTE_READBACK_MAX bytes.
+ */
+#define VIVANTE_READBACK_MAX		(8 * 1024 * 1024)
+
+struct vivante_readback {
+	struct drm_armada_bo *bo;
+	void *info;
+	uint32_t handle;
+	unsigned long reads, grows, oneoff;
+};
+
+/* Operations which may be done with the CPU when that is cheaper */
+enum vivante_op {
+	VIVANTE_OP_FILL,
+	VIVANTE_OP_COPY,
+	VIVANTE_OP_PUTIMAGE,
+	VIVANTE_OP_READBACK,
+	VIVANTE_NR_OPS,
+};
+
+#define VIVANTE_MAX_THRESHOLD	(1 << 20)
+
+/* Size thresholds in pixels below which the CPU is used, and decisions */
+struct vivante_cost {
+	long threshold[VIVANTE_NR_OPS];
+	unsigned long cpu[VIVANTE_NR_OPS];
+	unsigned long gpu[VIVANTE_NR_OPS];
+};
+
+/* Cache of freed pixmap bos, bucketed by size */
+#define VIVANTE_BO_CACHE_BUCKETS	14
+#define VIVANTE_BO_CACHE_BYTES		(16 * 1024 * 1024)
+#define VIVANTE_BO_CACHE_EXPIRE		2000	/* ms */
+#define VIVANTE_BO_CACHE_PITCH_SLACK	128
+
+struct vivante_bo_cache {
+	struct xorg_list bucket[VIVANTE_BO_CACHE_BUCKETS];
+	struct xorg_list lru;
+	size_t size;
+	unsigned long hits, misses, trimmed;
+};
+
+/* Sizes of the commits submitted to the GPU */
+struct vivante_commit_stats {
+	unsigned long commits;
+	unsigned long early;
+	unsigned long long ops;
+	unsigned long long pixels;
+	unsigned max_ops;
+	unsigned long max_pixels;
+};
+
 struct vivante {
 	int drm_fd;
 	gcoOS os;
@@ -48,25 +299,55 @@ struct vivante {
 	gco2D e2d;
 	unsigned max_rect_count;
 #ifdef VIVANTE_BATCH
-	struct drm_armada_bo *batch_bo;
-	int32_t *batch_ptr;
-	void *batch_info;
-	uint32_t batch_handle;
-	uint16_t batch_idx_max;
-	uint16_t batch_idx;
+	struct vivante_batch_page *batch_page[VIVANTE_MAX_BATCH_PAGES];
+	unsigned batch_nr_pages;
+	unsigned batch_slot;
 	int32_t batch_serial;
 	struct xorg_list batch_list;
 	struct vivante_batch *batch;
+	struct vivante_freelist batch_freelist;
+	gctSIGNAL batch_signal[VIVANTE_BATCH_SIGNALS];
+	unsigned batch_nr_signals;
+	struct {
+		unsigned long signalled, polled;
+		unsigned long long total_us;
+		unsigned long max_us;
+	} batch_wait;
 #else
 	Bool need_stall;
 #endif
 
+	struct vivante_freelist pixmap_freelist;
+	struct vivante_bo_cache bo_cache;
+	struct vivante_scratch scratch;
+
+	/* Work queued since the last commit, and the early commit limits */
+	unsigned commit_ops;
+	unsigned long commit_pixels;
+	unsigned commit_max_ops;
+	unsigned long commit_max_pixels;
+	struct vivante_commit_stats commit_stats;
+
+	struct vivante_tile_cache tile_cache;
+	struct vivante_temp_pool temp_pool;
+	struct vivante_glyph_atlas glyph_atlas;
+#ifdef RENDER
+	struct vivante_glyph_cache glyph_cache;
+#endif
+	struct vivante_staging staging;
+	struct vivante_readback readback;
+	struct vivante_cost cost;
+
+	/* SHMEM bos stay mapped to the GPU while the kernel manages caches */
+	Bool bo_cache_maint;
+	struct {
+		unsigned long maps, unmaps, cleans, invalidates;
+	} bo_stats;
+
 	Bool pe20;
 	Bool need_commit;
 	Bool force_fallback;
-#ifdef RENDER
-	Bool alpha_blend_enabled;
-#endif
+	struct vivante_2d_state state;
 	struct drm_armada_bufmgr *bufmgr;
 	int scrnIndex;
 #ifdef HAVE_DRI2
@@ -83,6 +364,7 @@ struct vivante {
 	CreateGCProcPtr CreateGC;
 	BitmapToRegionProcPtr BitmapToRegion;
 	ScreenBlockHandlerProcPtr BlockHandler;
+	UnrealizeFontProcPtr UnrealizeFont;
 
 	CompositeProcPtr Composite;
 	GlyphsProcPtr Glyphs;
@@ -104,9 +386,12 @@ struct vivante_pixmap {
 
 #ifdef VIVANTE_BATCH
 	struct xorg_list batch_node;
+	struct xorg_list batch_write_node;
 	struct vivante_batch *batch;
+	struct vivante_batch *batch_write;
 #else
 	Bool need_stall;
+	Bool need_stall_write;
 #endif
 
 	enum {
@@ -114,6 +399,14 @@ struct vivante_pixmap {
 		CPU,
 		GPU,
 	} owner;
+	Bool tile_cached;
+	Bool bo_reuse;		/* bo may be kept in the bo cache when freed */
+	struct xorg_list cache_node;
+	struct xorg_list cache_lru;
+	CARD32 cache_time;
+	uint8_t bpp;
+	Bool cpu_dirty;		/* CPU may have written since the GPU owned it */
+	Bool gpu_dirty;		/* GPU may have written since the CPU owned it */
 #ifdef DEBUG_CHECK_DRAWABLE_USE
 	int in_use;
 #endif
@@ -128,24 +421,60 @@ Bool vivante_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
 	DDXPointPtr ppt, int *pwidth, int fSorted);
 Bool vivante_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
 	int x, int y, int w, int h, int leftPad, int format, char *bits);
+Bool vivante_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+	unsigned int format, unsigned long planeMask, char *d);
+Bool vivante_accel_GetSpans(DrawablePtr pDrawable, int wMax, DDXPointPtr ppt,
+	int *pwidth, int nspans, char *pdstStart);
 void vivante_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
 	Bool upsidedown, Pixel bitPlane, void *closure);
+void vivante_accel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst,
+	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
+	Bool upsidedown, Pixel bitPlane, void *closure);
 Bool vivante_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
 	int npt, DDXPointPtr ppt);
+Bool vivante_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt);
+Bool vivante_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg);
+Bool vivante_accel_GlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned nglyph, CharInfoPtr *ppci, Bool image);
 Bool vivante_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
 Bool vivante_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
+Bool vivante_accel_PushPixels(GCPtr pGC, PixmapPtr pBitmap,
+	DrawablePtr pDrawable, int w, int h, int x, int y);
 
 /* 3D acceleration */
 int vivante_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
 	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height);
+Bool vivante_accel_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int nlist,
+	GlyphListPtr list, GlyphPtr *glyphs);
 
 void vivante_commit(struct vivante *vivante, Bool stall);
 
-void vivante_batch_wait_commit(struct vivante *vivante, struct vivante_pixmap *vPix);
+void vivante_batch_wait_commit(struct vivante *vivante,
+	struct vivante_pixmap *vPix, int access);
+
+void vivante_tile_cache_invalidate(struct vivante *vivante,
+	struct vivante_pixmap *vPix);
+void vivante_tile_cache_fini(struct vivante *vivante);
+
+void vivante_temp_pool_trim(struct vivante *vivante, CARD32 expire);
+void vivante_temp_pool_fini(struct vivante *vivante);
+
+void vivante_glyph_atlas_flush_font(struct vivante *vivante, FontPtr font);
+void vivante_glyph_atlas_fini(struct vivante *vivante);
+
+#ifdef RENDER
+void vivante_glyph_cache_remove(struct vivante *vivante, GlyphPtr glyph);
+void vivante_glyph_cache_fini(struct vivante *vivante);
+#endif
+
+void vivante_dump_stats(struct vivante *vivante);
 
 void vivante_accel_shutdown(struct vivante *);
 Bool vivante_accel_init(struct vivante *);
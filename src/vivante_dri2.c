@@ -255,6 +255,9 @@ fprintf(stderr, "%s: %p %u %u\n", __func__, drawable, attachment, format);
 		goto err;
 	}
 
+	/* The bo is now shared with the client, so must not be reused */
+	vpix->bo_reuse = FALSE;
+
 	buf->dri2.attachment = attachment;
 	buf->dri2.name = name;
 	buf->dri2.pitch = pixmap->devKind;
@@ -243,3 +243,15 @@ void vivante_unaccel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 		vivante_finish_drawable(pSrc, ACCESS_RO);
 	vivante_finish_drawable(pDst, ACCESS_RW);
 }
+
+void vivante_unaccel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	BoxPtr pBox, int nBox, int dx, int dy, Bool reverse, Bool upsidedown,
+	Pixel bitPlane, void *closure)
+{
+	vivante_prepare_drawable(pDst, ACCESS_RW);
+	vivante_prepare_drawable(pSrc, ACCESS_RO);
+	fbCopy1toN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse, upsidedown,
+			   bitPlane, closure);
+	vivante_finish_drawable(pSrc, ACCESS_RO);
+	vivante_finish_drawable(pDst, ACCESS_RW);
+}
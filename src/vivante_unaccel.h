@@ -45,6 +45,9 @@ RegionPtr vivante_unaccel_BitmapToRegion(PixmapPtr pixmap);
 void vivante_unaccel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 	BoxPtr pBox, int nBox, int dx, int dy, Bool reverse, Bool upsidedown,
 	Pixel bitPlane, void *closure);
+void vivante_unaccel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	BoxPtr pBox, int nBox, int dx, int dy, Bool reverse, Bool upsidedown,
+	Pixel bitPlane, void *closure);
 
 void vivante_unaccel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
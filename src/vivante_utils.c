@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -21,7 +22,9 @@
 #include "gcstruct.h"
 #include "xf86.h"
 
+#include <xf86drm.h>
 #include <armada_bufmgr.h>
+#include "armada_ioctl.h"
 #include "gal_extension.h"
 
 #include "vivante_accel.h"
@@ -117,6 +120,7 @@ void vivante_unmap_gpu(struct vivante *vivante, struct vivante_pixmap *vPix)
 
 	vPix->handle = -1;
 	vPix->info = NULL;
+	vivante->bo_stats.unmaps++;
 }
 
 
@@ -163,6 +167,45 @@ void vivante_unmap_from_gpu(struct vivante *vivante, void *info,
 	gcoOS_UnmapUserMemory(vivante->os, (void *)1, 1, info, handle);
 }
 
+/*
+ * SHMEM bos stay mapped to the GPU for the life of the pixmap, and
+ * ownership changes are handled by cleaning the CPU caches over the
+ * first 'size' bytes of the bo before the GPU uses data the CPU wrote,
+ * and invalidating them before the CPU reads data the GPU wrote.  If
+ * the kernel fails the request, the caller must fall back to unmapping
+ * the bo from the GPU on each change, which lets galcore do the
+ * maintenance.
+ */
+Bool vivante_bo_cache_maint(struct vivante *vivante,
+	struct drm_armada_bo *bo, size_t size, uint32_t op)
+{
+	struct drm_armada_gem_cache arg;
+
+	if (!vivante->bo_cache_maint)
+		return FALSE;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.ptr = (uintptr_t)bo->ptr;
+	arg.handle = bo->handle;
+	arg.size = size;
+	arg.op = op;
+
+	if (drmIoctl(vivante->drm_fd, DRM_IOCTL_ARMADA_GEM_CACHE, &arg)) {
+		xf86DrvMsg(vivante->scrnIndex, X_WARNING,
+			   "vivante: bo cache maintenance failed, unmapping pixmaps from the GPU instead: %s\n",
+			   strerror(errno));
+		vivante->bo_cache_maint = FALSE;
+		return FALSE;
+	}
+
+	if (op == OP_USER_CLN)
+		vivante->bo_stats.cleans++;
+	else
+		vivante->bo_stats.invalidates++;
+
+	return TRUE;
+}
+
 /*
  * Map a pixmap to the GPU, and mark the GPU as owning this BO.
  */
@@ -178,21 +221,32 @@ Bool vivante_map_gpu(struct vivante *vivante, struct vivante_pixmap *vPix)
 		return TRUE;
 
 	if (bo->type == DRM_ARMADA_BO_SHMEM) {
-		gceSTATUS err;
-		gctUINT32 addr;
-
-		err = gcoOS_MapUserMemory(vivante->os, bo->ptr, bo->size,
-					  &vPix->info, &addr);
-		if (err != gcvSTATUS_OK) {
-			vivante_error(vivante, "gcoOS_MapUserMemory", err);
-			return FALSE;
-		}
+		/* Remapping the bo also cleans the caches */
+		if (vPix->info && vPix->cpu_dirty &&
+		    !vivante_bo_cache_maint(vivante, bo,
+					    vPix->pitch * vPix->height,
+					    OP_USER_CLN))
+			vivante_unmap_gpu(vivante, vPix);
+
+		if (!vPix->info) {
+			gceSTATUS err;
+			gctUINT32 addr;
+
+			err = gcoOS_MapUserMemory(vivante->os, bo->ptr,
+						  bo->size, &vPix->info, &addr);
+			if (err != gcvSTATUS_OK) {
+				vivante_error(vivante, "gcoOS_MapUserMemory", err);
+				return FALSE;
+			}
 
 #ifdef DEBUG_MAP
-		dbg("Mapped vPix %p bo %p to 0x%08x\n", vPix, bo, addr);
+			dbg("Mapped vPix %p bo %p to 0x%08x\n", vPix, bo, addr);
 #endif
 
-		vPix->handle = addr;
+			vPix->handle = addr;
+			vivante->bo_stats.maps++;
+		}
+		vPix->cpu_dirty = FALSE;
 	}
 	vPix->owner = GPU;
 
@@ -218,9 +272,9 @@ void vivante_finish_drawable(DrawablePtr pDrawable, int access)
 }
 
 /*
- * Prepare a bo for CPU access.  If the GPU has been accessing the
- * pixmap data, we need to unmap the buffer from the GPU to ensure
- * that our view is up to date.
+ * Prepare a bo for CPU access.  If the GPU has written the pixmap
+ * data, we need to invalidate the CPU caches for a SHMEM bo (or unmap
+ * it from the GPU) to ensure that our view is up to date.
  */
 void vivante_prepare_drawable(DrawablePtr pDrawable, int access)
 {
@@ -231,11 +285,26 @@ void vivante_prepare_drawable(DrawablePtr pDrawable, int access)
 		struct vivante *vivante = vivante_get_screen_priv(pDrawable->pScreen);
 
 		/* Ensure that the drawable is up to date with all GPU operations */
-		vivante_batch_wait_commit(vivante, vPix);
+		vivante_batch_wait_commit(vivante, vPix, access);
+
+		if (access == ACCESS_RW && vPix->tile_cached)
+			vivante_tile_cache_invalidate(vivante, vPix);
 
 		if (vPix->bo->type == DRM_ARMADA_BO_SHMEM) {
-			if (vPix->owner == GPU)
+			/*
+			 * If we have to unmap the bo, it must also be idle
+			 * for any GPU reads.
+			 */
+			if (vPix->owner == GPU && vPix->gpu_dirty &&
+			    !vivante_bo_cache_maint(vivante, vPix->bo,
+					vPix->pitch * vPix->height,
+					OP_USER_INV)) {
+				vivante_batch_wait_commit(vivante, vPix, ACCESS_RW);
 				vivante_unmap_gpu(vivante, vPix);
+			}
+			vPix->gpu_dirty = FALSE;
+			if (access == ACCESS_RW)
+				vPix->cpu_dirty = TRUE;
 
 			pixmap->devPrivate.ptr = vPix->bo->ptr;
 		}
@@ -246,6 +315,132 @@ void vivante_prepare_drawable(DrawablePtr pDrawable, int access)
 	}
 }
 
+/*
+ * Fixed size object allocator.  Objects are carved out of chunks, and
+ * are kept on a free list when released rather than being returned to
+ * malloc.  The first object-sized slot of each chunk links the chunks
+ * together so that they can be released by vivante_freelist_fini().
+ */
+#define FREELIST_CHUNK_OBJS 32
+
+void vivante_freelist_init(struct vivante_freelist *fl, size_t size)
+{
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	fl->free = NULL;
+	fl->chunks = NULL;
+	fl->size = (size + 7) & ~7;
+	fl->hits = 0;
+	fl->misses = 0;
+}
+
+Bool vivante_freelist_refill(struct vivante_freelist *fl)
+{
+	char *chunk, *p;
+	unsigned i;
+
+	chunk = malloc(fl->size * (FREELIST_CHUNK_OBJS + 1));
+	if (!chunk)
+		return FALSE;
+
+	*(void **)chunk = fl->chunks;
+	fl->chunks = chunk;
+
+	for (i = FREELIST_CHUNK_OBJS; i; i--) {
+		p = chunk + i * fl->size;
+		*(void **)p = fl->free;
+		fl->free = p;
+	}
+
+	return TRUE;
+}
+
+void vivante_freelist_fini(struct vivante_freelist *fl)
+{
+	while (fl->chunks) {
+		void *next = *(void **)fl->chunks;
+
+		free(fl->chunks);
+		fl->chunks = next;
+	}
+	fl->free = NULL;
+}
+
+struct vivante_scratch_block {
+	struct vivante_scratch_block *next;
+	uint64_t data[];
+};
+
+Bool vivante_scratch_init(struct vivante_scratch *s, size_t size)
+{
+	memset(s, 0, sizeof(*s));
+
+	s->base = malloc(size);
+	if (!s->base)
+		return FALSE;
+
+	s->size = size;
+
+	return TRUE;
+}
+
+void *vivante_scratch_overflow(struct vivante_scratch *s, size_t size)
+{
+	struct vivante_scratch_block *b;
+
+	b = malloc(sizeof(*b) + size);
+	if (!b)
+		return NULL;
+
+	b->next = s->overflow;
+	s->overflow = b;
+
+	return b->data;
+}
+
+static void vivante_scratch_free_overflow(struct vivante_scratch *s)
+{
+	struct vivante_scratch_block *b, *n;
+
+	for (b = s->overflow; b; b = n) {
+		n = b->next;
+		free(b);
+	}
+	s->overflow = NULL;
+}
+
+void vivante_scratch_reset(struct vivante_scratch *s)
+{
+	if (s->overflow) {
+		size_t size = s->size;
+		char *base;
+
+		vivante_scratch_free_overflow(s);
+
+		/* Grow the arena to cover this cycle's usage */
+		while (size < s->total)
+			size *= 2;
+
+		base = malloc(size);
+		if (base) {
+			free(s->base);
+			s->base = base;
+			s->size = size;
+		}
+	}
+	s->used = 0;
+	s->total = 0;
+}
+
+void vivante_scratch_fini(struct vivante_scratch *s)
+{
+	vivante_scratch_free_overflow(s);
+	free(s->base);
+	s->base = NULL;
+	s->size = 0;
+}
+
 #ifdef RENDER
 gceSURF_FORMAT vivante_pict_format(PictFormatShort format, Bool force)
 {
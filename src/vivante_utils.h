@@ -36,6 +36,8 @@ Bool vivante_map_bo_to_gpu(struct vivante *vivante, struct drm_armada_bo *bo,
 void vivante_unmap_from_gpu(struct vivante *vivante, void *info,
 	uint32_t handle);
 
+Bool vivante_bo_cache_maint(struct vivante *vivante,
+	struct drm_armada_bo *bo, size_t size, uint32_t op);
 void vivante_unmap_gpu(struct vivante *vivante, struct vivante_pixmap *vPix);
 Bool vivante_map_gpu(struct vivante *vivante, struct vivante_pixmap *vPix);
 
@@ -78,6 +80,63 @@ static inline void RectBox(gcsRECT_PTR rect, const BoxRec *box, int off_x, int o
 	rect->bottom = box->y2 + off_y;
 }
 
+void vivante_freelist_init(struct vivante_freelist *fl, size_t size);
+void vivante_freelist_fini(struct vivante_freelist *fl);
+Bool vivante_freelist_refill(struct vivante_freelist *fl);
+
+static inline void *vivante_freelist_alloc(struct vivante_freelist *fl)
+{
+	void **obj;
+
+	if (fl->free) {
+		fl->hits++;
+	} else {
+		fl->misses++;
+		if (!vivante_freelist_refill(fl))
+			return NULL;
+	}
+
+	obj = fl->free;
+	fl->free = *obj;
+
+	return obj;
+}
+
+static inline void vivante_freelist_free(struct vivante_freelist *fl, void *obj)
+{
+	*(void **)obj = fl->free;
+	fl->free = obj;
+}
+
+Bool vivante_scratch_init(struct vivante_scratch *s, size_t size);
+void vivante_scratch_fini(struct vivante_scratch *s);
+void vivante_scratch_reset(struct vivante_scratch *s);
+void *vivante_scratch_overflow(struct vivante_scratch *s, size_t size);
+
+/*
+ * Allocate temporary memory which remains valid until the next
+ * vivante_scratch_reset(), which happens from the block handler.
+ */
+static inline void *vivante_scratch_alloc(struct vivante_scratch *s,
+	size_t size)
+{
+	void *p;
+
+	size = (size + 7) & ~7;
+
+	s->total += size;
+	if (s->total > s->high_water)
+		s->high_water = s->total;
+
+	if (s->size - s->used < size)
+		return vivante_scratch_overflow(s, size);
+
+	p = s->base + s->used;
+	s->used += size;
+
+	return p;
+}
+
 void dump_Drawable(DrawablePtr pDraw, const char *, ...);
 void dump_Picture(PicturePtr pDst, const char *, ...);
 void dump_vPix(struct vivante *vivante, struct vivante_pixmap *vPix,